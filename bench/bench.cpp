@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "allocation_counter.h"
+#include "image_merger.h"
+#include "simd_blend.h"
+
+namespace {
+
+struct Case {
+    std::string source;
+    std::string algorithm;
+    std::string method;
+    int size;
+    std::size_t bytes;
+};
+
+struct Timings {
+    double min{};
+    double median{};
+    double p99{};
+    double mean{};
+    double allocations{};
+};
+
+struct Result {
+    Case bench_case;
+    Timings load;
+    Timings kernel;
+    Timings write;
+};
+
+struct Settings {
+    std::vector<int> sizes{256, 512, 1024, 2048, 4096, 8192};
+    std::vector<std::string> algorithms{"base", "cache", "openmp", "optimized", "simd", "pooled", "stream", "roi",
+                                        "resample", "masked"};
+    std::vector<std::string> methods{"average", "linear", "max"};
+    std::filesystem::path inputs{"resources/input"};
+    std::filesystem::path scratch{std::filesystem::temp_directory_path() / "image_merger_bench"};
+    std::filesystem::path json{};
+    std::filesystem::path csv{};
+    int warmup{2};
+    int repetitions{10};
+    float weight{0.5f};
+    bool synthetic{true};
+    std::string write_mode{"stream"};
+};
+
+std::map<std::string, Bmp::WriteMode> const write_modes{{"stream", Bmp::WriteMode::stream},
+                                                        {"vectored", Bmp::WriteMode::vectored},
+                                                        {"map", Bmp::WriteMode::map},
+                                                        {"direct", Bmp::WriteMode::direct}};
+
+std::map<std::string, Algorithm> const algorithms{{"base", Algorithm::base},
+                                                  {"cache", Algorithm::cache},
+                                                  {"openmp", Algorithm::openmp},
+                                                  {"optimized", Algorithm::optimized},
+                                                  {"simd", Algorithm::simd},
+                                                  {"pooled", Algorithm::simd},
+                                                  {"stream", Algorithm::simd},
+                                                  {"roi", Algorithm::simd},
+                                                  {"resample", Algorithm::simd},
+                                                  {"masked", Algorithm::simd}};
+
+std::vector<std::string> split(std::string const &list) {
+    std::vector<std::string> ret{};
+    std::stringstream in{list};
+    for (std::string item; std::getline(in, item, ',');) {
+        if (!item.empty()) { ret.push_back(item); }
+    }
+    return ret;
+}
+
+Timings summarize(std::vector<double> samples, double allocations) {
+    std::sort(samples.begin(), samples.end());
+    auto const at = [&](double quantile) {
+        auto const index = static_cast<std::size_t>(quantile * static_cast<double>(samples.size() - 1) + 0.5);
+        return samples[std::min(index, samples.size() - 1)];
+    };
+    double total = 0;
+    for (auto sample: samples) { total += sample; }
+    return {samples.front(), at(0.5), at(0.99), total / static_cast<double>(samples.size()),
+            allocations / static_cast<double>(samples.size())};
+}
+
+/**
+ * Runs a function warmup + repetitions times and returns the durations of the measured runs in seconds,
+ * along with the heap allocations they made per run.
+ */
+template<typename Function>
+Timings measure(Settings const &settings, Function &&function) {
+    std::vector<double> samples{};
+    // reserved up front, so the only allocations during the runs are the ones of the measured function
+    samples.reserve(std::max(settings.repetitions, 1));
+    for (int i = 0; i < settings.warmup; ++i) { function(); }
+    auto const allocations = heap_allocations();
+    for (int i = 0; i < std::max(settings.repetitions, 1); ++i) {
+        auto const start = std::chrono::steady_clock::now();
+        function();
+        samples.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    auto const measured_allocations = static_cast<double>(heap_allocations() - allocations);
+    return summarize(std::move(samples), measured_allocations);
+}
+
+/**
+ * Writes a square 24-bit image filled with reproducible noise.
+ */
+std::filesystem::path write_synthetic(Settings const &settings, int size, unsigned seed, uint16_t bits_per_pixel = 24) {
+    auto path = settings.scratch / ("synthetic_" + std::to_string(seed) + "_" + std::to_string(size) + "_" +
+                                    std::to_string(bits_per_pixel) + ".bmp");
+    if (std::filesystem::exists(path)) { return path; }
+    auto const header = Bmp::make_header(size, size, bits_per_pixel);
+    std::vector<std::byte> pixels(header.image_size);
+    std::mt19937 generator{seed};
+    for (std::size_t i = 0; i < pixels.size(); i += 4) {
+        auto const value = generator();
+        for (std::size_t j = 0; j < 4 && i + j < pixels.size(); ++j) {
+            pixels[i + j] = std::byte(value >> (8 * j));
+        }
+    }
+    Bmp{header, std::move(pixels)}.write_image(path);
+    return path;
+}
+
+double gigabytes_per_second(std::size_t bytes, double seconds) {
+    return seconds > 0 ? static_cast<double>(bytes) / 1e9 / seconds : 0;
+}
+
+/**
+ * Times loading, merging and writing. The pooled version loads into and merges through a MergeContext, like a
+ * long-running worker does, the others allocate fresh buffers for every merge. roi reads and merges the centred
+ * rectangle of half the edge length, resample blends a synthetic second image of half the size with bilinear
+ * filtering, and masked weights the blend with a synthetic 32-bit mask. stream reads, merges and writes band by band,
+ * so it is timed end to end as its kernel and has no separate load and write times.
+ */
+Result run_case(Settings const &settings, Case bench_case, std::filesystem::path const &first,
+                std::filesystem::path second) {
+    MergeOptions options{};
+    if (bench_case.algorithm == "roi") {
+        auto const offset = static_cast<uint32_t>(bench_case.size / 4);
+        auto const edge = static_cast<uint32_t>(std::max(bench_case.size / 2, 1));
+        options.region = Bmp::Region{offset, offset, edge, edge};
+    } else if (bench_case.algorithm == "resample") {
+        options.resample = Resample::bilinear;
+        second = write_synthetic(settings, std::max(bench_case.size / 2, 1), 2);
+    } else if (bench_case.algorithm == "masked") {
+        options.mask = write_synthetic(settings, bench_case.size, 3, 32);
+    }
+    ImageMerger merger{options};
+    MergeContext context{};
+    bool const pooled = bench_case.algorithm == "pooled";
+    auto const merge_val = *blend_mode_from_name(bench_case.method);
+    auto const algorithm = algorithms.at(bench_case.algorithm);
+    auto const out_path = settings.scratch / "out.bmp";
+    auto const load_image = [&](std::filesystem::path const &path) {
+        if (options.region) { return Bmp{path, *options.region}; }
+        return pooled ? context.load(path) : Bmp{path, Bmp::LoadMode::read};
+    };
+
+    if (bench_case.algorithm == "stream") {
+        bench_case.bytes = load_image(first).getPixels().size();
+        auto const kernel = measure(settings, [&] {
+            merger.merge_images_streaming(merge_val, first, second, out_path, settings.weight);
+        });
+        return {bench_case, {}, kernel, {}};
+    }
+    auto const merge = [&](Bmp const &first_image, Bmp const &second_image) {
+        return pooled ? merger.merge(context, merge_val, first_image, second_image, settings.weight)
+                      : merger.merge(merge_val, first_image, second_image, settings.weight, algorithm);
+    };
+
+    auto const load = measure(settings, [&] {
+        Bmp first_image = load_image(first);
+        Bmp second_image = load_image(second);
+    });
+
+    Bmp const first_image = load_image(first);
+    Bmp const second_image = load_image(second);
+    bench_case.bytes = first_image.getPixels().size();
+    Bmp out = merge(first_image, second_image);
+    auto const kernel = measure(settings, [&] {
+        // release the previous output first, so the pool can hand its buffer out again
+        out = Bmp{out.getHeader(), std::vector<std::byte>{}};
+        out = merge(first_image, second_image);
+    });
+    auto const write = measure(settings, [&] { out.write_image(out_path, write_modes.at(settings.write_mode)); });
+    return {bench_case, load, kernel, write};
+}
+
+void write_json(Settings const &settings, std::vector<Result> const &results) {
+    std::ofstream out{settings.json};
+    auto const timings = [&](Timings const &t) {
+        std::ostringstream ret{};
+        ret << std::setprecision(9) << "{\"min\": " << t.min << ", \"median\": " << t.median << ", \"p99\": " << t.p99
+            << ", \"mean\": " << t.mean << ", \"allocations\": " << t.allocations << "}";
+        return ret.str();
+    };
+    out << "{\n  \"isa\": \"" << simd::isa_name(simd::active_isa()) << "\",\n  \"threads\": " << omp_get_max_threads()
+        << ",\n  \"warmup\": " << settings.warmup << ",\n  \"repetitions\": " << settings.repetitions << ",\n  \"write_mode\": \"" << settings.write_mode
+        << "\",\n  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        auto const &result = results[i];
+        auto const &c = result.bench_case;
+        out << "    {\"source\": \"" << c.source << "\", \"size\": " << c.size << ", \"algorithm\": \"" << c.algorithm
+            << "\", \"method\": \"" << c.method << "\", \"bytes\": " << c.bytes << ", \"load_s\": " << timings(result.load)
+            << ", \"kernel_s\": " << timings(result.kernel) << ", \"write_s\": " << timings(result.write)
+            << ", \"kernel_gb_per_s\": " << gigabytes_per_second(3 * c.bytes, result.kernel.median) << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void write_csv(Settings const &settings, std::vector<Result> const &results) {
+    std::ofstream out{settings.csv};
+    out << "source,size,algorithm,method,bytes,load_min_s,load_median_s,load_p99_s,kernel_min_s,kernel_median_s,"
+           "kernel_p99_s,write_min_s,write_median_s,write_p99_s,kernel_gb_per_s,kernel_allocations\n";
+    out << std::setprecision(9);
+    for (auto const &result: results) {
+        auto const &c = result.bench_case;
+        out << c.source << ',' << c.size << ',' << c.algorithm << ',' << c.method << ',' << c.bytes << ','
+            << result.load.min << ',' << result.load.median << ',' << result.load.p99 << ',' << result.kernel.min << ','
+            << result.kernel.median << ',' << result.kernel.p99 << ',' << result.write.min << ',' << result.write.median
+            << ',' << result.write.p99 << ',' << gigabytes_per_second(3 * c.bytes, result.kernel.median) << ','
+            << result.kernel.allocations << '\n';
+    }
+}
+
+void print(Result const &result) {
+    auto const &c = result.bench_case;
+    std::cout << std::left << std::setw(10) << c.source << std::right << std::setw(6) << c.size << "  " << std::left
+              << std::setw(10) << c.algorithm << std::setw(8) << c.method << std::right << std::fixed
+              << std::setprecision(3) << std::setw(10) << result.load.median * 1e3 << std::setw(10)
+              << result.kernel.min * 1e3 << std::setw(10) << result.kernel.median * 1e3 << std::setw(10)
+              << result.kernel.p99 * 1e3 << std::setw(10) << result.write.median * 1e3 << std::setw(9)
+              << std::setprecision(2) << gigabytes_per_second(3 * c.bytes, result.kernel.median) << std::setw(8)
+              << std::setprecision(1) << result.kernel.allocations << std::endl;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    Settings settings{};
+    for (int i = 1; i < argc; ++i) {
+        std::string argument{argv[i]};
+        auto const separator = argument.find('=');
+        auto const name = argument.substr(0, separator);
+        auto const value = separator == std::string::npos ? std::string{} : argument.substr(separator + 1);
+        if (name == "--sizes") {
+            settings.sizes.clear();
+            for (auto const &size: split(value)) { settings.sizes.push_back(std::stoi(size)); }
+        } else if (name == "--algorithms") {
+            settings.algorithms = split(value);
+        } else if (name == "--methods") {
+            settings.methods = split(value);
+        } else if (name == "--inputs") {
+            settings.inputs = value;
+        } else if (name == "--scratch") {
+            settings.scratch = value;
+        } else if (name == "--json") {
+            settings.json = value;
+        } else if (name == "--csv") {
+            settings.csv = value;
+        } else if (name == "--warmup") {
+            settings.warmup = std::stoi(value);
+        } else if (name == "--repetitions") {
+            settings.repetitions = std::stoi(value);
+        } else if (name == "--weight") {
+            settings.weight = std::stof(value);
+        } else if (name == "--no-synthetic") {
+            settings.synthetic = false;
+        } else if (name == "--write" && write_modes.contains(value)) {
+            settings.write_mode = value;
+        } else {
+            std::cout << "Usage: " << argv[0]
+                      << " [--sizes=256,512,...] [--algorithms=base,cache,openmp,optimized,simd,pooled,stream,roi,resample,masked]"
+                         " [--methods=average,max,min,...]"
+                         " [--inputs=dir] [--scratch=dir] [--json=file] [--csv=file] [--warmup=N] [--repetitions=N]"
+                         " [--weight=W] [--no-synthetic] [--write=stream|vectored|map|direct]\n";
+            return name == "--help" ? 0 : 1;
+        }
+    }
+    for (auto const &algorithm: settings.algorithms) {
+        if (!algorithms.contains(algorithm)) {
+            std::cerr << "Unknown algorithm version " << algorithm << ".\n";
+            return 1;
+        }
+    }
+    for (auto const &method: settings.methods) {
+        if (!blend_mode_from_name(method)) {
+            std::cerr << "Unknown merging method " << method << ".\n";
+            return 1;
+        }
+    }
+    std::filesystem::create_directories(settings.scratch);
+
+    std::cout << "isa " << simd::isa_name(simd::active_isa()) << ", " << omp_get_max_threads() << " threads, "
+              << settings.warmup << " warmup runs, " << settings.repetitions << " repetitions, " << settings.write_mode
+              << " writes, times in ms\n";
+    std::cout << "source      size  algorithm method   load_med  kern_min  kern_med  kern_p99 write_med     GB/s  allocs\n";
+
+    std::vector<Result> results{};
+    for (int size: settings.sizes) {
+        std::vector<std::pair<std::string, std::pair<std::filesystem::path, std::filesystem::path>>> sources{};
+        auto const first_input = settings.inputs / ("1_" + std::to_string(size) + ".bmp");
+        auto const second_input = settings.inputs / ("2_" + std::to_string(size) + ".bmp");
+        if (std::filesystem::exists(first_input) && std::filesystem::exists(second_input)) {
+            sources.push_back({"resources", {first_input, second_input}});
+        }
+        if (settings.synthetic) {
+            sources.push_back({"synthetic", {write_synthetic(settings, size, 1), write_synthetic(settings, size, 2)}});
+        }
+        for (auto const &[source, paths]: sources) {
+            for (auto const &algorithm: settings.algorithms) {
+                for (auto const &method: settings.methods) {
+                    // a mask only weights the average mode
+                    if (algorithm == "masked" && method != "average") { continue; }
+                    results.push_back(run_case(settings, {source, algorithm, method, size, 0}, paths.first, paths.second));
+                    print(results.back());
+                }
+            }
+        }
+    }
+
+    if (!settings.json.empty()) { write_json(settings, results); }
+    if (!settings.csv.empty()) { write_csv(settings, results); }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include <cstdlib>
+#include <new>
+#include "allocation_counter.h"
+
+// only the benchmark replaces the global operator new, the library and the command line keep the default one
+
+namespace {
+
+// retries after the installed new handler made room, like the default operator new
+template<typename Allocate>
+void *allocate(Allocate &&allocate) {
+    note_heap_allocation();
+    for (;;) {
+        if (void *ret = allocate()) { return ret; }
+        auto const handler = std::get_new_handler();
+        if (!handler) { throw std::bad_alloc(); }
+        handler();
+    }
+}
+
+}
+
+// the array and nothrow forms of the default library call these, the deletes are replaced as a matching set
+void *operator new(std::size_t size) {
+    return allocate([&] { return std::malloc(size ? size : 1); });
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    auto const align = static_cast<std::size_t>(alignment);
+    // aligned_alloc needs a size that is a multiple of the alignment
+    return allocate([&] { return std::aligned_alloc(align, ((size ? size : 1) + align - 1) & ~(align - 1)); });
+}
+
+void operator delete(void *data) noexcept {
+    std::free(data);
+}
+
+void operator delete(void *data, std::size_t) noexcept {
+    std::free(data);
+}
+
+void operator delete(void *data, std::align_val_t) noexcept {
+    std::free(data);
+}
+
+void operator delete(void *data, std::size_t, std::align_val_t) noexcept {
+    std::free(data);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <span>
+#include <sys/mman.h>
+#include "allocation_counter.h"
+
+/**
+ * An owned, uninitialised byte buffer whose start is aligned to a cache line or a page.
+ * Leaving the bytes uninitialised means the first write, not the allocation, decides on which NUMA node a page lives.
+ */
+class AlignedBuffer {
+    struct Free {
+        void operator()(std::byte *data) const { std::free(data); }
+    };
+
+    std::unique_ptr<std::byte, Free> data{};
+    std::size_t size{0};
+
+public:
+    static constexpr std::size_t cache_line = 64;
+    static constexpr std::size_t page = 4096;
+    static constexpr std::size_t huge_page = 2 << 20;
+
+    AlignedBuffer() = default;
+
+    /**
+ * Allocates an uninitialised buffer. Throws std::bad_alloc if the allocation fails.
+ *
+ * @param size       The number of bytes.
+ * @param alignment  The alignment of the first byte, a power of two. Buffers aligned to a huge page are advised
+ *                       to be backed by transparent huge pages.
+ */
+    explicit AlignedBuffer(std::size_t size, std::size_t alignment = page) : size(size) {
+        if (size == 0) { return; }
+        // aligned_alloc needs a size that is a multiple of the alignment
+        auto const padded = (size + alignment - 1) & ~(alignment - 1);
+        data.reset(static_cast<std::byte *>(std::aligned_alloc(alignment, padded)));
+        if (!data) { throw std::bad_alloc(); }
+        note_heap_allocation();
+        if (alignment >= huge_page) { madvise(data.get(), padded, MADV_HUGEPAGE); }
+    }
+
+    [[nodiscard]] std::span<std::byte> getBytes() { return {data.get(), size}; }
+
+    [[nodiscard]] std::span<const std::byte> getBytes() const { return {data.get(), size}; }
+};
@@ -0,0 +1,17 @@
+#include <atomic>
+#include "allocation_counter.h"
+
+namespace {
+
+// constant initialised, so allocations made by other static constructors are counted as well
+constinit std::atomic<std::size_t> allocations{0};
+
+}
+
+std::size_t heap_allocations() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void note_heap_allocation() {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Counts heap allocations, so a steady state can be shown to be allocation free. AlignedBuffer reports its
+ * aligned_alloc calls. A program that wants every new expression and standard container counted as well replaces the
+ * global operator new and reports its calls, as the benchmark does. Calls to malloc from C code are not counted.
+ *
+ * @return The number of heap allocations since the program started.
+ */
+std::size_t heap_allocations();
+
+/**
+ * Adds an allocation made outside of operator new to the counter.
+ */
+void note_heap_allocation();
@@ -0,0 +1,474 @@
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "async_loader.h"
+
+/**
+ * A read of one range of one file, resubmitted until the whole range has arrived.
+ */
+struct AsyncLoader::Read {
+    PairLoad *load{};
+    std::size_t input{};
+    bool header{};
+    int fd{-1};
+    std::byte *data{};
+    std::size_t size{};
+    off_t offset{};
+};
+
+/**
+ * The state of one load_pair call. pending counts the reads of the current phase, headers first and pixels second.
+ */
+struct AsyncLoader::PairLoad {
+    struct Input {
+        std::filesystem::path path{};
+        int fd{-1};
+        std::size_t file_size{};
+        Bmp::BmpHeader header{};
+        std::shared_ptr<AlignedBuffer> pixels{};
+        Read read{};
+    };
+
+    std::promise<std::pair<Bmp, Bmp>> promise{};
+    std::array<Input, 2> inputs{};
+    std::atomic<int> pending{0};
+    std::atomic<bool> failed{false};
+    bool same_size{true};
+    std::mutex mutex{};
+    std::exception_ptr error{};
+
+    void fail(std::exception_ptr exception) {
+        std::lock_guard lock{mutex};
+        if (!failed.exchange(true)) { error = std::move(exception); }
+    }
+
+    void fail(std::string const &message) { fail(std::make_exception_ptr(std::runtime_error(message))); }
+};
+
+class AsyncLoader::Backend {
+public:
+    virtual ~Backend() = default;
+
+    virtual void submit(Read &read) = 0;
+
+    [[nodiscard]] virtual AsyncBackend kind() const = 0;
+};
+
+namespace {
+
+/**
+ * Runs blocking preads on a few threads. Completions may submit further reads from a worker, so the queue is unbounded.
+ */
+class ThreadBackend final : public AsyncLoader::Backend {
+    AsyncLoader &loader;
+    std::mutex mutex{};
+    std::condition_variable ready{};
+    std::deque<AsyncLoader::Read *> reads{};
+    bool stopping{false};
+    std::vector<std::jthread> workers{};
+
+    void work() {
+        for (;;) {
+            AsyncLoader::Read *read;
+            {
+                std::unique_lock lock{mutex};
+                ready.wait(lock, [&] { return stopping || !reads.empty(); });
+                if (reads.empty()) { return; }
+                read = reads.front();
+                reads.pop_front();
+            }
+            auto const count = pread(read->fd, read->data, read->size, read->offset);
+            loader.complete(*read, count < 0 ? -errno : count);
+        }
+    }
+
+public:
+    ThreadBackend(AsyncLoader &loader, std::size_t threads) : loader(loader) {
+        for (std::size_t i = 0; i < std::max<std::size_t>(threads, 1); ++i) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~ThreadBackend() override {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        ready.notify_all();
+        workers.clear();
+    }
+
+    void submit(AsyncLoader::Read &read) override {
+        {
+            std::lock_guard lock{mutex};
+            reads.push_back(&read);
+        }
+        ready.notify_one();
+    }
+
+    [[nodiscard]] AsyncBackend kind() const override { return AsyncBackend::threads; }
+};
+
+int io_uring_setup(unsigned entries, io_uring_params *params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+/**
+ * Talks to io_uring through the raw system calls. Submissions are serialised by a mutex, a single reaper thread
+ * waits for completions. Reads beyond the ring size wait in a backlog that the reaper drains as slots free up,
+ * so a completion that submits the next read never blocks the only thread that could make room for it.
+ */
+class UringBackend final : public AsyncLoader::Backend {
+    static constexpr unsigned entries = 64;
+
+    AsyncLoader &loader;
+    int ring{-1};
+    void *sq_ring{MAP_FAILED};
+    std::size_t sq_ring_size{};
+    void *cq_ring{MAP_FAILED};
+    std::size_t cq_ring_size{};
+    io_uring_sqe *sqes{static_cast<io_uring_sqe *>(MAP_FAILED)};
+    std::size_t sqes_size{};
+
+    unsigned *sq_tail{};
+    unsigned sq_mask{};
+    unsigned *sq_array{};
+    unsigned *cq_head{};
+    unsigned *cq_tail{};
+    unsigned cq_mask{};
+    io_uring_cqe *cqes{};
+
+    std::mutex mutex{};
+    unsigned in_flight{0};
+    std::deque<AsyncLoader::Read *> backlog{};
+    std::jthread reaper{};
+
+    template<typename T>
+    static T *at(void *base, unsigned offset) {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    /**
+     * Puts a read into the next free submission slot, the caller holds the mutex and calls enter afterwards.
+     */
+    void push(AsyncLoader::Read *read, uint8_t opcode = IORING_OP_READ) {
+        unsigned const tail = *sq_tail;
+        unsigned const index = tail & sq_mask;
+        auto &sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        if (read) {
+            sqe.fd = read->fd;
+            sqe.addr = reinterpret_cast<uint64_t>(read->data);
+            sqe.len = static_cast<uint32_t>(std::min<std::size_t>(read->size, 1u << 30));
+            sqe.off = static_cast<uint64_t>(read->offset);
+        }
+        sqe.user_data = reinterpret_cast<uint64_t>(read);
+        sq_array[index] = index;
+        std::atomic_ref{*sq_tail}.store(tail + 1, std::memory_order_release);
+        ++in_flight;
+    }
+
+    /**
+     * Submits the last to_submit pushed slots, the caller holds the mutex. Slots the kernel refuses are taken back
+     * out of the ring, so they can not be submitted later, and their reads are put into refused.
+     *
+     * @return 0, or the errno of the refusal.
+     */
+    int enter(unsigned to_submit, std::span<AsyncLoader::Read *> refused) {
+        while (to_submit > 0) {
+            int const submitted = io_uring_enter(ring, to_submit, 0, 0);
+            if (submitted < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) { continue; }
+                int const error = errno;
+                unsigned const tail = *sq_tail - to_submit;
+                for (unsigned i = 0; i < to_submit; ++i) {
+                    refused[i] = reinterpret_cast<AsyncLoader::Read *>(sqes[(tail + i) & sq_mask].user_data);
+                }
+                std::atomic_ref{*sq_tail}.store(tail, std::memory_order_release);
+                in_flight -= to_submit;
+                return error;
+            }
+            to_submit -= static_cast<unsigned>(submitted);
+        }
+        return 0;
+    }
+
+    void reap() {
+        for (;;) {
+            unsigned const head = std::atomic_ref{*cq_head}.load(std::memory_order_relaxed);
+            if (head == std::atomic_ref{*cq_tail}.load(std::memory_order_acquire)) {
+                io_uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+                continue;
+            }
+            auto const cqe = cqes[head & cq_mask];
+            std::atomic_ref{*cq_head}.store(head + 1, std::memory_order_release);
+
+            auto *read = reinterpret_cast<AsyncLoader::Read *>(cqe.user_data);
+            if (!read) { return; }
+            std::array<AsyncLoader::Read *, entries> refused{};
+            unsigned pushed = 0;
+            int error = 0;
+            {
+                std::lock_guard lock{mutex};
+                --in_flight;
+                for (; !backlog.empty() && in_flight < entries; ++pushed) {
+                    push(backlog.front());
+                    backlog.pop_front();
+                }
+                error = enter(pushed, refused);
+            }
+            // completions run outside the mutex, they may submit the next reads
+            loader.complete(*read, cqe.res);
+            for (unsigned i = 0; error != 0 && i < pushed; ++i) { loader.complete(*refused[i], -error); }
+        }
+    }
+
+public:
+    explicit UringBackend(AsyncLoader &loader) : loader(loader) {
+        io_uring_params params{};
+        ring = io_uring_setup(entries, &params);
+        if (ring < 0) { return; }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) { return; }
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ring = sq_ring;
+        } else {
+            cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring,
+                           IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED) { return; }
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                                ring, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) { return; }
+
+        sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+        sq_mask = *at<unsigned>(sq_ring, params.sq_off.ring_mask);
+        sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+        cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+        cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+        cq_mask = *at<unsigned>(cq_ring, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+        reaper = std::jthread{[this] { reap(); }};
+    }
+
+    ~UringBackend() override {
+        if (reaper.joinable()) {
+            // a nop without a read tells the reaper to stop, the loader has no reads in flight anymore
+            {
+                std::lock_guard lock{mutex};
+                push(nullptr, IORING_OP_NOP);
+                std::array<AsyncLoader::Read *, 1> refused{};
+                // without the nop the reaper can not be woken and would use the ring after it is unmapped
+                if (enter(1, refused) != 0) { std::terminate(); }
+            }
+            reaper.join();
+        }
+        if (sqes != MAP_FAILED) { munmap(sqes, sqes_size); }
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) { munmap(cq_ring, cq_ring_size); }
+        if (sq_ring != MAP_FAILED) { munmap(sq_ring, sq_ring_size); }
+        if (ring >= 0) { close(ring); }
+    }
+
+    /**
+     * Whether the ring was set up, kernels or sandboxes without io_uring fail in io_uring_setup.
+     */
+    [[nodiscard]] bool ready() const { return reaper.joinable(); }
+
+    void submit(AsyncLoader::Read &read) override {
+        std::array<AsyncLoader::Read *, 1> refused{};
+        int error = 0;
+        {
+            std::lock_guard lock{mutex};
+            if (in_flight < entries) {
+                push(&read);
+                error = enter(1, refused);
+            } else {
+                backlog.push_back(&read);
+            }
+        }
+        if (error != 0) { loader.complete(read, -error); }
+    }
+
+    [[nodiscard]] AsyncBackend kind() const override { return AsyncBackend::io_uring; }
+};
+
+}
+
+AsyncLoader::AsyncLoader(MergeContext &context, AsyncBackend requested, std::size_t threads) : context(context) {
+    if (requested == AsyncBackend::io_uring) {
+        auto uring = std::make_unique<UringBackend>(*this);
+        if (uring->ready()) { backend = std::move(uring); }
+    }
+    if (!backend) { backend = std::make_unique<ThreadBackend>(*this, threads); }
+}
+
+AsyncLoader::~AsyncLoader() {
+    std::unique_lock lock{mutex};
+    idle.wait(lock, [&] { return in_flight == 0; });
+}
+
+AsyncBackend AsyncLoader::getBackend() const {
+    return backend->kind();
+}
+
+std::future<std::pair<Bmp, Bmp>>
+AsyncLoader::load_pair(const std::filesystem::path &first, const std::filesystem::path &second, bool same_size) {
+    auto load = std::make_unique<PairLoad>();
+    auto ret = load->promise.get_future();
+    load->same_size = same_size;
+    load->inputs[0].path = first;
+    load->inputs[1].path = second;
+    for (auto &input: load->inputs) {
+        struct stat status{};
+        input.fd = open(input.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (input.fd < 0 || fstat(input.fd, &status) != 0) {
+            load->fail("File " + input.path.string() + " failed to open.\n");
+            break;
+        }
+        input.file_size = static_cast<std::size_t>(status.st_size);
+    }
+    {
+        std::lock_guard lock{mutex};
+        ++in_flight;
+    }
+    if (load->failed) {
+        finish(load.release());
+        return ret;
+    }
+
+    // both headers are requested at once, the pixel reads follow once both are known to be valid
+    load->pending = 2;
+    for (std::size_t i = 0; i < load->inputs.size(); ++i) {
+        auto &input = load->inputs[i];
+        input.read = Read{load.get(), i, true, input.fd, reinterpret_cast<std::byte *>(&input.header),
+                          sizeof(input.header), 0};
+    }
+    auto *pair = load.release();
+    for (auto &input: pair->inputs) { submit(input.read); }
+    return ret;
+}
+
+void AsyncLoader::submit(Read &read) {
+    try {
+        backend->submit(read);
+    } catch (...) {
+        // a read that can not even be queued completes as failed, so its load still finishes
+        read.load->fail(std::current_exception());
+        complete(read, -ECANCELED);
+    }
+}
+
+void AsyncLoader::complete(Read &read, long result) {
+    auto &load = *read.load;
+    auto &input = load.inputs[read.input];
+    // this runs on the backend's threads, whatever goes wrong here is handed to the load's future instead
+    try {
+        if (result == -EINTR || result == -EAGAIN) {
+            submit(read);
+            return;
+        }
+        if (result < 0) {
+            load.fail("File " + input.path.string() + " failed to read: " + std::strerror(static_cast<int>(-result)) +
+                      "\n");
+        } else if (result == 0 && read.size > 0) {
+            load.fail("File " + input.path.string() + " is too small to be a bmp image.\n");
+        } else if (static_cast<std::size_t>(result) < read.size) {
+            read.data += result;
+            read.size -= static_cast<std::size_t>(result);
+            read.offset += result;
+            submit(read);
+            return;
+        } else if (read.header) {
+            // validated right away, before the other header or any pixels have arrived
+            auto const &header = input.header;
+            if (header.signature != 0x4d42 || header.offset < sizeof(header) || header.offset > input.file_size) {
+                load.fail("File " + input.path.string() + " is not a bmp image.\n");
+            }
+        }
+    } catch (...) {
+        load.fail(std::current_exception());
+    }
+
+    if (--load.pending > 0) { return; }
+    if (read.header && !load.failed) {
+        try {
+            auto const &first = load.inputs[0];
+            auto const &second = load.inputs[1];
+            bool const same_size =
+                    first.header.width == second.header.width && first.header.height == second.header.height;
+            if ((load.same_size && !same_size) ||
+                (same_size && second.file_size - second.header.offset < first.file_size - first.header.offset)) {
+                load.fail("Images aren't matching.\n");
+            } else {
+                submit_pixels(load);
+                return;
+            }
+        } catch (...) {
+            load.fail(std::current_exception());
+        }
+    }
+    finish(&load);
+}
+
+void AsyncLoader::submit_pixels(PairLoad &load) {
+    // both buffers are acquired before the first read is submitted, so a failed allocation leaves nothing in flight
+    for (std::size_t i = 0; i < load.inputs.size(); ++i) {
+        auto &input = load.inputs[i];
+        input.pixels = context.acquire(input.file_size - input.header.offset);
+        input.read = Read{&load, i, false, input.fd, input.pixels->getBytes().data(), input.pixels->getBytes().size(),
+                          static_cast<off_t>(input.header.offset)};
+    }
+    load.pending = 2;
+    for (auto &input: load.inputs) { submit(input.read); }
+}
+
+void AsyncLoader::finish(PairLoad *load) {
+    std::unique_ptr<PairLoad> owned{load};
+    for (auto const &input: owned->inputs) {
+        if (input.fd >= 0) { close(input.fd); }
+    }
+    try {
+        if (owned->failed) {
+            owned->promise.set_exception(owned->error);
+        } else {
+            auto &[first, second] = owned->inputs;
+            owned->promise.set_value({Bmp{first.header, std::move(first.pixels)},
+                                      Bmp{second.header, std::move(second.pixels)}});
+        }
+    } catch (...) {
+        owned->promise.set_exception(std::current_exception());
+    }
+    owned.reset();
+    std::lock_guard lock{mutex};
+    if (--in_flight == 0) { idle.notify_all(); }
+}
+
+const char *async_backend_name(AsyncBackend backend) {
+    return backend == AsyncBackend::io_uring ? "io_uring" : "threads";
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "bmp.h"
+#include "merge_context.h"
+
+/**
+ * How an AsyncLoader issues its reads. io_uring submits them to a ring shared with the kernel and reaps them on a
+ * completion thread, threads runs blocking preads on a small pool of threads.
+ */
+enum class AsyncBackend { io_uring, threads };
+
+/**
+ * Loads the two inputs of a merge concurrently into pooled buffers of a MergeContext. Both header reads are issued at
+ * once and every header is validated as soon as its 54 bytes arrive, so an invalid or mismatched pair fails before
+ * any pixels are read. The pixel reads of both images are then issued at once as well.
+ * Any number of pairs may be in flight, e.g. the inputs of the next jobs of a batch while the current one is merged.
+ */
+class AsyncLoader {
+public:
+    class Backend;
+    struct Read;
+    struct PairLoad;
+
+private:
+    MergeContext &context;
+    std::unique_ptr<Backend> backend;
+    std::mutex mutex{};
+    std::condition_variable idle{};
+    std::size_t in_flight{0};
+
+    /**
+ * Hands a read to the backend. A read the backend can not take completes as failed instead of throwing.
+ */
+    void submit(Read &read);
+
+    void submit_pixels(PairLoad &load);
+
+    void finish(PairLoad *load);
+
+public:
+    /**
+ * Constructs a loader. If the io_uring backend is requested but the kernel does not allow it, the thread backend
+ * is used instead.
+ *
+ * @param context  The context whose pool provides the pixel buffers.
+ * @param backend  The requested backend.
+ * @param threads  The number of threads of the thread backend.
+ */
+    explicit AsyncLoader(MergeContext &context, AsyncBackend backend = AsyncBackend::io_uring, std::size_t threads = 4);
+
+    AsyncLoader(AsyncLoader const &) = delete;
+
+    AsyncLoader &operator=(AsyncLoader const &) = delete;
+
+    /**
+ * Waits for all pairs in flight before the backend is stopped.
+ */
+    ~AsyncLoader();
+
+    /**
+ * Gets the backend that is actually used.
+ *
+ * @return The backend.
+ */
+    [[nodiscard]] AsyncBackend getBackend() const;
+
+    /**
+ * Starts loading two images that are going to be merged with each other.
+ * The future holds std::runtime_error if a file can not be read, is not a bmp image or the images aren't matching.
+ *
+ * @param first      The path to the first image.
+ * @param second     The path to the second image.
+ * @param same_size  Whether images of different sizes are rejected, false when the second one is resampled.
+ * @return A future that becomes ready once both images are in memory.
+ */
+    std::future<std::pair<Bmp, Bmp>> load_pair(std::filesystem::path const &first, std::filesystem::path const &second,
+                                               bool same_size = true);
+
+    /**
+ * Called by a backend when a read has finished. Never throws, every error ends up in the future of the read's pair.
+ *
+ * @param read    The read.
+ * @param result  The number of bytes read, or a negative errno value.
+ */
+    void complete(Read &read, long result);
+};
+
+/**
+ * Gets the printable name of an async loading backend.
+ *
+ * @param backend The backend.
+ * @return The name of the backend.
+ */
+const char *async_backend_name(AsyncBackend backend);
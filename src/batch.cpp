@@ -0,0 +1,164 @@
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "batch.h"
+#include "bounded_queue.h"
+#include "command_line.h"
+
+BatchRunner::BatchRunner(MergeOptions merge_options, BatchOptions batch_options) : merge_options(merge_options),
+                                                                                    batch_options(batch_options) {}
+
+std::vector<BatchJob> BatchRunner::read_manifest(const std::filesystem::path &manifest) {
+    std::ifstream in{manifest};
+    if (!in) {
+        throw std::runtime_error("File " + manifest.string() + " failed to open.\n");
+    }
+    std::vector<BatchJob> ret{};
+    std::size_t line_number = 0;
+    for (std::string line; std::getline(in, line);) {
+        ++line_number;
+        std::istringstream fields{line};
+        std::string method{};
+        if (!(fields >> method) || method.starts_with("#")) { continue; }
+
+        BatchJob job{};
+        job.line = line_number;
+        if (auto const mode = blend_mode_from_name(method)) {
+            job.mode = *mode;
+        } else {
+            throw std::runtime_error("Line " + std::to_string(line_number) + ": unknown merging method " + method + ".\n");
+        }
+        if (!(fields >> job.first >> job.second >> job.output)) {
+            throw std::runtime_error("Line " + std::to_string(line_number) + ": expected two inputs and an output.\n");
+        }
+        if (std::string weight{}; fields >> weight) {
+            if (!parse_number(weight, job.weight) || job.weight > 1.0 || job.weight < 0.0) {
+                throw std::runtime_error("Line " + std::to_string(line_number) + ": weight " + weight +
+                                         " is not a number in range [0.0,1.0].\n");
+            }
+        }
+        ret.push_back(std::move(job));
+    }
+    return ret;
+}
+
+BatchStats BatchRunner::run(const std::vector<BatchJob> &jobs) {
+    struct Loaded {
+        const BatchJob *job;
+        Bmp first;
+        Bmp second;
+    };
+    struct Merged {
+        const BatchJob *job;
+        Bmp image;
+        std::optional<uint64_t> key;
+    };
+
+    BoundedQueue<Loaded> loaded{batch_options.queue_size};
+    BoundedQueue<Merged> merged{batch_options.queue_size};
+    std::atomic<std::size_t> next_job{0};
+    std::atomic<std::size_t> active_loaders{std::max<std::size_t>(batch_options.loaders, 1)};
+    std::atomic<std::size_t> failed{0};
+    std::atomic<std::size_t> bytes{0};
+
+    auto fail = [&](BatchJob const &job, std::string const &message) {
+        std::cerr << "Line " << job.line << ": " << message;
+        ++failed;
+    };
+
+    // constructed before any loader starts, a throwing constructor would leave them blocked on a queue nobody pops
+    ImageMerger merger{merge_options};
+    // the inputs and results of the jobs in flight cycle through one pool instead of being allocated per job
+    MergeContext context{};
+    auto const start = std::chrono::steady_clock::now();
+
+    std::vector<std::jthread> loaders{};
+    std::vector<std::jthread> writers{};
+    // destroyed before the threads are joined, so an exception on this thread lets blocked loaders and writers finish
+    struct CloseQueues {
+        BoundedQueue<Loaded> &loaded;
+        BoundedQueue<Merged> &merged;
+
+        ~CloseQueues() {
+            loaded.close();
+            merged.close();
+        }
+    } const close_queues{loaded, merged};
+    if (merge_options.async_load) {
+        // a single thread keeps the reads of the next queue_size jobs in flight and hands them on in manifest order
+        active_loaders = 0;
+        loaders.emplace_back([&] {
+            AsyncLoader loader{context, merge_options.async_backend, batch_options.loaders};
+            std::deque<std::pair<const BatchJob *, std::future<std::pair<Bmp, Bmp>>>> window{};
+            std::size_t const depth = std::max<std::size_t>(batch_options.queue_size, 1);
+            for (std::size_t index = 0; index < jobs.size() || !window.empty();) {
+                for (; index < jobs.size() && window.size() < depth; ++index) {
+                    window.emplace_back(&jobs[index], loader.load_pair(jobs[index].first, jobs[index].second,
+                                                                        merge_options.resample == Resample::none));
+                }
+                auto [job, pending] = std::move(window.front());
+                window.pop_front();
+                try {
+                    auto [first, second] = pending.get();
+                    bytes += first.getPixels().size() + second.getPixels().size();
+                    loaded.push(Loaded{job, std::move(first), std::move(second)});
+                } catch (std::exception &e) {
+                    fail(*job, e.what());
+                }
+            }
+            loaded.close();
+        });
+    }
+    for (std::size_t i = 0; i < active_loaders; ++i) {
+        loaders.emplace_back([&] {
+            for (std::size_t index; (index = next_job++) < jobs.size();) {
+                auto const &job = jobs[index];
+                // read into memory, mapping would leave the disk reads to the merge stage
+                try {
+                    Bmp first = context.load(job.first);
+                    Bmp second = context.load(job.second);
+                    bytes += first.getPixels().size() + second.getPixels().size();
+                    loaded.push(Loaded{&job, std::move(first), std::move(second)});
+                } catch (std::exception &e) {
+                    fail(job, e.what());
+                }
+            }
+            if (--active_loaders == 0) { loaded.close(); }
+        });
+    }
+
+    for (std::size_t i = 0; i < std::max<std::size_t>(batch_options.writers, 1); ++i) {
+        writers.emplace_back([&] {
+            while (auto item = merged.pop()) {
+                if (item->image.write_image(item->job->output, merge_options.write_mode).empty()) {
+                    fail(*item->job, "Output failed to write.\n");
+                    continue;
+                }
+                bytes += item->image.getPixels().size();
+                if (item->key) { merger.getResultCache()->store(*item->key, item->job->output); }
+            }
+        });
+    }
+
+    while (auto item = loaded.pop()) {
+        try {
+            // a cached result is linked to the output right here and never reaches the writers
+            auto const key = merger.result_key(item->job->mode, item->first, item->second, item->job->weight);
+            if (key && merger.getResultCache()->fetch(*key, item->job->output)) { continue; }
+            merged.push(Merged{item->job, merger.merge(context, item->job->mode, item->first, item->second,
+                                                                 item->job->weight), key});
+        } catch (std::exception &e) {
+            fail(*item->job, e.what());
+        }
+    }
+    merged.close();
+    loaders.clear();
+    writers.clear();
+
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    return BatchStats{jobs.size(), failed, bytes, std::chrono::duration<double>(elapsed).count()};
+}
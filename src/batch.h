@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+#include "image_merger.h"
+
+/**
+ * A single merge read from a batch manifest.
+ */
+struct BatchJob {
+    BlendMode mode{BlendMode::average};
+    std::filesystem::path first{};
+    std::filesystem::path second{};
+    std::filesystem::path output{};
+    float weight{0.5f};
+    std::size_t line{};
+};
+
+/**
+ * Sizes of the batch pipeline stages.
+ */
+struct BatchOptions {
+    std::size_t loaders{2};
+    std::size_t writers{1};
+    std::size_t queue_size{4};
+};
+
+/**
+ * Totals of a finished batch.
+ */
+struct BatchStats {
+    std::size_t jobs{};
+    std::size_t failed{};
+    std::size_t bytes{};
+    double seconds{};
+
+    [[nodiscard]] double images_per_second() const { return seconds > 0 ? static_cast<double>(jobs - failed) / seconds : 0; }
+
+    [[nodiscard]] double megabytes_per_second() const { return seconds > 0 ? static_cast<double>(bytes) / 1e6 / seconds : 0; }
+};
+
+/**
+ * Runs many merges in one process as a pipeline. Loader threads read the inputs of upcoming jobs, the calling thread
+ * merges them with ImageMerger::merge, and writer threads write the results. The stages are connected by bounded
+ * queues, so at most a few jobs are held in memory at once, and their pixels are recycled through a MergeContext.
+ * With MergeOptions::async_load, a single AsyncLoader replaces the loader threads and keeps the reads of the next
+ * queue_size jobs in flight. With MergeOptions::result_cache, jobs whose result is cached skip the merge and the write.
+ */
+class BatchRunner {
+    MergeOptions merge_options;
+    BatchOptions batch_options;
+
+public:
+    BatchRunner(MergeOptions merge_options, BatchOptions batch_options);
+
+/**
+ * Reads a manifest with one job per line, written as
+ * <merging method [average,max,min,...]> <path to first image> <path to second image> <path to output> [weight].
+ * Empty lines and lines starting with # are skipped. Throws std::runtime_error on a malformed line.
+ *
+ * @param manifest The path of the manifest file.
+ * @return The jobs in the order they appear in the manifest.
+ */
+    static std::vector<BatchJob> read_manifest(std::filesystem::path const &manifest);
+
+/**
+ * Runs every job of a manifest. Failed jobs are reported on stderr and counted, the remaining jobs still run.
+ *
+ * @param jobs The jobs to run.
+ * @return The number of jobs, failures, bytes read and written, and the elapsed time.
+ */
+    BatchStats run(std::vector<BatchJob> const &jobs);
+};
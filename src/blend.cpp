@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include "blend.h"
+
+FixedWeight FixedWeight::from(float weight, Rounding rounding) {
+    auto const first = static_cast<uint16_t>(std::lround(std::clamp(weight, 0.0f, 1.0f) * 256.0f));
+    return {first, static_cast<uint16_t>(256 - first), static_cast<uint16_t>(rounding == Rounding::nearest ? 128 : 0)};
+}
+
+namespace srgb {
+
+// the exact sRGB transfer functions, only used to fill the tables
+std::array<uint16_t, 256 + 1> const decode = [] {
+    std::array<uint16_t, 256 + 1> ret{};
+    for (unsigned i = 0; i < 256; ++i) {
+        double const value = i / 255.0;
+        double const linear = value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+        ret[i] = static_cast<uint16_t>(std::lround(linear * ((1u << linear_bits) - 1)));
+    }
+    return ret;
+}();
+
+std::array<uint8_t, (1u << linear_bits) + 3> const encode = [] {
+    std::array<uint8_t, (1u << linear_bits) + 3> ret{};
+    for (unsigned i = 0; i < 1u << linear_bits; ++i) {
+        double const linear = static_cast<double>(i) / ((1u << linear_bits) - 1);
+        double const value = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+        ret[i] = static_cast<uint8_t>(std::lround(value * 255));
+    }
+    return ret;
+}();
+
+BlendTable const &blend_table(FixedWeight weight) {
+    static std::mutex mutex{};
+    static std::unordered_map<uint64_t, std::unique_ptr<BlendTable>> tables{};
+    uint64_t const key = static_cast<uint64_t>(weight.first) << 32 | static_cast<uint64_t>(weight.second) << 16 |
+                         weight.bias;
+    std::lock_guard const lock{mutex};
+    auto &table = tables[key];
+    if (!table) {
+        // the weights sum to 256, so the blend of two 12-bit values is a 12-bit value again
+        table = std::make_unique<BlendTable>();
+        for (unsigned a = 0; a < 256; ++a) {
+            for (unsigned b = 0; b < 256; ++b) {
+                unsigned const mixed = (decode[a] * weight.first + decode[b] * weight.second + weight.bias) >> 8;
+                (*table)[a << 8 | b] = encode[std::min(mixed, (1u << linear_bits) - 1)];
+            }
+        }
+    }
+    return *table;
+}
+
+}
+
+namespace {
+
+constexpr std::pair<BlendMode, const char *> mode_names[]{
+        {BlendMode::max, "max"}, {BlendMode::average, "average"}, {BlendMode::min, "min"},
+        {BlendMode::add, "add"}, {BlendMode::subtract, "subtract"}, {BlendMode::multiply, "multiply"},
+        {BlendMode::screen, "screen"}, {BlendMode::difference, "difference"}, {BlendMode::overlay, "overlay"},
+        {BlendMode::linear, "linear"}};
+
+}
+
+std::optional<BlendMode> blend_mode_from_name(std::string_view name) {
+    for (auto const &[mode, mode_name]: mode_names) {
+        if (name == mode_name) { return mode; }
+    }
+    return std::nullopt;
+}
+
+std::optional<Ramp> ramp_from_name(std::string_view name) {
+    if (name == "linear") { return Ramp::linear; }
+    if (name == "ease") { return Ramp::ease; }
+    return std::nullopt;
+}
+
+float ramp_weight(Ramp ramp, std::size_t frame, std::size_t frames) {
+    float const t = frames > 1 ? static_cast<float>(frame) / static_cast<float>(frames - 1) : 0.0f;
+    return 1.0f - (ramp == Ramp::ease ? t * t * (3.0f - 2.0f * t) : t);
+}
+
+const char *blend_mode_name(BlendMode mode) {
+    for (auto const &[candidate, name]: mode_names) {
+        if (candidate == mode) { return name; }
+    }
+    return "unknown";
+}
+
+BlendDeviation verify_blend(float weight, Rounding rounding) {
+    auto const fixed = FixedWeight::from(weight, rounding);
+    BlendDeviation ret{weight};
+    for (int a = 0; a < 256; ++a) {
+        for (int b = 0; b < 256; ++b) {
+            // the same expression the float merge path used
+            int const from_float = std::to_integer<int>(std::byte(weight * a + (1 - weight) * b));
+            auto const exact = static_cast<int>(std::lround(static_cast<double>(weight) * a + (1.0 - weight) * b));
+            int const value = std::to_integer<int>(fixed.apply(std::byte(a), std::byte(b)));
+
+            ret.max_from_float = std::max(ret.max_from_float, std::abs(value - from_float));
+            ret.max_from_exact = std::max(ret.max_from_exact, std::abs(value - exact));
+            ret.mismatches += value != from_float;
+        }
+    }
+    return ret;
+}
+
+std::vector<BlendDeviation> verify_blend_range(Rounding rounding, int steps) {
+    steps = std::max(steps, 1);
+    std::vector<BlendDeviation> ret(steps + 1);
+#pragma omp parallel for
+    for (int i = 0; i <= steps; ++i) {
+        ret[i] = verify_blend(static_cast<float>(i) / static_cast<float>(steps), rounding);
+    }
+    return ret;
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+/**
+ * Rounding applied when a weighted blend is narrowed back to a byte.
+ * truncate rounds down like the float formula used to, nearest rounds to the nearest value of the blend with the
+ * weight quantized to 1/256, which can still differ by 1 from the exactly rounded blend with the original weight.
+ */
+enum class Rounding { truncate, nearest };
+
+/**
+ * A blending weight converted once into an 8.8 fixed-point factor, so the weighted blend
+ * out = (first * a + second * b + bias) >> 8 runs entirely in integers.
+ * The largest intermediate value is 255 * 256 + 128, which fits into a 16-bit lane.
+ */
+struct FixedWeight {
+    uint16_t first{128};
+    uint16_t second{128};
+    uint16_t bias{0};
+
+    /**
+     * Converts a weight from the range [0.0,1.0] into a fixed-point factor.
+     *
+     * @param weight    The weight of the first image.
+     * @param rounding  The rounding used when narrowing the blended value.
+     * @return The fixed-point weight.
+     */
+    static FixedWeight from(float weight, Rounding rounding);
+
+    [[nodiscard]] std::byte apply(std::byte a, std::byte b) const {
+        return std::byte((std::to_integer<unsigned>(a) * first + std::to_integer<unsigned>(b) * second + bias) >> 8);
+    }
+};
+
+/**
+ * Blends two bytes with a per-pixel weight of the first one, read from a mask. The mask value is stretched from
+ * [0,255] to the 8.8 fixed-point range [0,256] first, so 255 keeps only the first byte and a mask blends like a
+ * FixedWeight of mask / 255.
+ *
+ * @param a     The byte of the first image.
+ * @param b     The byte of the second image.
+ * @param mask  The weight of the first image.
+ * @param bias  The rounding bias, as in FixedWeight.
+ * @return The blended byte.
+ */
+inline std::byte masked_blend(std::byte a, std::byte b, std::byte mask, uint16_t bias) {
+    unsigned const weight = std::to_integer<unsigned>(mask) + (std::to_integer<unsigned>(mask) >> 7);
+    unsigned const sum = std::to_integer<unsigned>(a) * weight + std::to_integer<unsigned>(b) * (256 - weight) + bias;
+    return std::byte(sum >> 8);
+}
+
+/**
+ * The operation used to combine two pixels. max and average keep the values 0 and 1 of the old integer merger flag.
+ * linear is the weighted average of the light the sRGB encoded bytes stand for, instead of the bytes themselves.
+ */
+enum class BlendMode { max = 0, average = 1, min, add, subtract, multiply, screen, difference, overlay, linear };
+
+/**
+ * Gets whether a blend mode uses the weight, i.e. is one of the weighted averages.
+ *
+ * @param mode The blend mode.
+ * @return Whether the mode is average or linear.
+ */
+inline bool uses_weight(BlendMode mode) {
+    return mode == BlendMode::average || mode == BlendMode::linear;
+}
+
+/**
+ * Conversion tables between sRGB encoded bytes and linear light in 12-bit fixed point, computed once at startup.
+ * 12 bits are enough for every byte to decode and encode back to itself. Both tables have spare entries at the end,
+ * so a vector gather of four bytes at the last entry stays inside the table.
+ */
+namespace srgb {
+
+constexpr unsigned linear_bits = 12;
+
+extern std::array<uint16_t, 256 + 1> const decode;
+
+extern std::array<uint8_t, (1u << linear_bits) + 3> const encode;
+
+/**
+ * The linear light blend of every pair of bytes for one weight, at index first << 8 | second, so a blend is a single
+ * lookup instead of two decodes and an encode.
+ */
+using BlendTable = std::array<uint8_t, (1u << 16) + 3>;
+
+/**
+ * Gets the blend table of a weight. Tables are built from decode and encode on first use and kept for the lifetime
+ * of the process, there are only as many as there are distinct weights.
+ *
+ * @param weight The fixed-point weight, including its rounding bias.
+ * @return The table, safe to use from any thread.
+ */
+BlendTable const &blend_table(FixedWeight weight);
+
+}
+
+/**
+ * Finds the blend mode with the given command line name.
+ *
+ * @param name The name of the mode, e.g. "average" or "screen".
+ * @return The mode, or an empty optional if no mode has this name.
+ */
+std::optional<BlendMode> blend_mode_from_name(std::string_view name);
+
+/**
+ * Gets the command line name of a blend mode.
+ *
+ * @param mode The blend mode.
+ * @return The name of the mode.
+ */
+const char *blend_mode_name(BlendMode mode);
+
+/**
+ * The shape of the weight over a crossfade. linear moves the weight by the same step every frame, ease is a smoothstep
+ * that starts and ends slowly.
+ */
+enum class Ramp { linear, ease };
+
+/**
+ * Finds the ramp with the given command line name.
+ *
+ * @param name The name of the ramp, "linear" or "ease".
+ * @return The ramp, or an empty optional if no ramp has this name.
+ */
+std::optional<Ramp> ramp_from_name(std::string_view name);
+
+/**
+ * Gets the weight of the first image in one frame of a crossfade from the first image to the second.
+ *
+ * @param ramp    The shape of the crossfade.
+ * @param frame   The index of the frame, the first frame shows only the first image.
+ * @param frames  The number of frames, the last frame shows only the second image.
+ * @return The weight, in the range [0.0,1.0].
+ */
+float ramp_weight(Ramp ramp, std::size_t frame, std::size_t frames);
+
+/**
+ * Blend operations as stateless policies, so kernels can be instantiated once per operation without branching on the
+ * mode in their inner loops. Each policy combines a byte of the first image (a) with a byte of the second image (b).
+ */
+namespace blend_ops {
+
+/**
+ * round(x * y / 255) for x and y in [0,255], computed without a division.
+ */
+inline unsigned multiply_255(unsigned x, unsigned y) {
+    unsigned const t = x * y + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+struct Max {
+    std::byte operator()(std::byte a, std::byte b) const { return a > b ? a : b; }
+};
+
+struct Average {
+    FixedWeight weight;
+
+    std::byte operator()(std::byte a, std::byte b) const { return weight.apply(a, b); }
+};
+
+struct Min {
+    std::byte operator()(std::byte a, std::byte b) const { return a < b ? a : b; }
+};
+
+struct Add {
+    std::byte operator()(std::byte a, std::byte b) const {
+        unsigned const sum = std::to_integer<unsigned>(a) + std::to_integer<unsigned>(b);
+        return std::byte(sum > 255 ? 255 : sum);
+    }
+};
+
+struct Subtract {
+    std::byte operator()(std::byte a, std::byte b) const {
+        return a > b ? std::byte(std::to_integer<unsigned>(a) - std::to_integer<unsigned>(b)) : std::byte{0};
+    }
+};
+
+struct Multiply {
+    std::byte operator()(std::byte a, std::byte b) const {
+        return std::byte(multiply_255(std::to_integer<unsigned>(a), std::to_integer<unsigned>(b)));
+    }
+};
+
+struct Screen {
+    std::byte operator()(std::byte a, std::byte b) const {
+        return std::byte(255 - multiply_255(255 - std::to_integer<unsigned>(a), 255 - std::to_integer<unsigned>(b)));
+    }
+};
+
+struct Difference {
+    std::byte operator()(std::byte a, std::byte b) const {
+        return a > b ? std::byte(std::to_integer<unsigned>(a) - std::to_integer<unsigned>(b))
+                     : std::byte(std::to_integer<unsigned>(b) - std::to_integer<unsigned>(a));
+    }
+};
+
+/**
+ * Averages in linear light, looking the result up in the blend table of the weight.
+ */
+struct Linear {
+    FixedWeight weight;
+    const uint8_t *table{srgb::blend_table(weight).data()};
+
+    std::byte operator()(std::byte a, std::byte b) const {
+        return std::byte(table[std::to_integer<unsigned>(a) << 8 | std::to_integer<unsigned>(b)]);
+    }
+};
+
+/**
+ * Multiplies dark values of the first image and screens light ones, using the first image as the base layer.
+ */
+struct Overlay {
+    std::byte operator()(std::byte a, std::byte b) const {
+        unsigned const x = std::to_integer<unsigned>(a);
+        unsigned const y = std::to_integer<unsigned>(b);
+        return std::byte(x < 128 ? multiply_255(2 * x, y) : 255 - multiply_255(2 * (255 - x), 255 - y));
+    }
+};
+
+}
+
+/**
+ * Calls a function with the policy of a blend mode, so the mode is branched on once per call instead of once per
+ * byte. The function is instantiated for every policy and must return the same type for all of them.
+ *
+ * @param mode      The blend mode.
+ * @param weight    The weight used by the average policy.
+ * @param function  Called as function(policy).
+ * @return The value returned by the function.
+ */
+template<typename Function>
+decltype(auto) with_blend_op(BlendMode mode, FixedWeight weight, Function &&function) {
+    switch (mode) {
+        case BlendMode::average: return function(blend_ops::Average{weight});
+        case BlendMode::min: return function(blend_ops::Min{});
+        case BlendMode::add: return function(blend_ops::Add{});
+        case BlendMode::subtract: return function(blend_ops::Subtract{});
+        case BlendMode::multiply: return function(blend_ops::Multiply{});
+        case BlendMode::screen: return function(blend_ops::Screen{});
+        case BlendMode::difference: return function(blend_ops::Difference{});
+        case BlendMode::overlay: return function(blend_ops::Overlay{});
+        case BlendMode::linear: return function(blend_ops::Linear{weight});
+        case BlendMode::max: break;
+    }
+    return function(blend_ops::Max{});
+}
+
+/**
+ * Maximum deviation of the fixed-point blend for a single weight, measured over every pair of byte values.
+ */
+struct BlendDeviation {
+    float weight{};
+    int max_from_float{};
+    int max_from_exact{};
+    std::size_t mismatches{};
+};
+
+/**
+ * Compares the fixed-point blend with the float formula weight * a + (1 - weight) * b truncated to a byte,
+ * and with the exactly rounded result, for all 65536 pairs of byte values.
+ *
+ * @param weight    The weight of the first image.
+ * @param rounding  The rounding of the fixed-point blend.
+ * @return The largest deviation found and the number of pairs that differ from the float formula.
+ */
+BlendDeviation verify_blend(float weight, Rounding rounding);
+
+/**
+ * Runs verify_blend for evenly spaced weights covering the range [0.0,1.0].
+ *
+ * @param rounding  The rounding of the fixed-point blend.
+ * @param steps     The number of intervals the weight range is split into.
+ * @return One result per weight, steps + 1 in total.
+ */
+std::vector<BlendDeviation> verify_blend_range(Rounding rounding, int steps);
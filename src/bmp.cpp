@@ -2,42 +2,178 @@
 // Created by nikola on 4/7/23.
 //
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <optional>
 #include <span>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include "bmp.h"
+#include "output_file.h"
+#include "trace.h"
 
+namespace {
 
-std::vector<std::byte> Bmp::load_image(const std::filesystem::path &image_path) {
+// enough zeros for the padding between the header and the pixels of every image written by this program
+constexpr std::array<std::byte, 4096> zeros{};
+
+/**
+ * Writes all parts with as few system calls as possible, resuming after short writes. Files are written from the
+ * given position with pwritev, an fd without a position like a pipe from wherever it is with writev.
+ */
+bool write_parts(int fd, std::span<iovec> parts, std::optional<off_t> position) {
+    while (!parts.empty()) {
+        auto const count = static_cast<int>(std::min<std::size_t>(parts.size(), IOV_MAX));
+        auto const written = position ? ::pwritev(fd, parts.data(), count, *position) : ::writev(fd, parts.data(), count);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) { return false; }
+        if (position) { *position += written; }
+        auto remaining = static_cast<std::size_t>(written);
+        while (!parts.empty() && remaining >= parts.front().iov_len) {
+            remaining -= parts.front().iov_len;
+            parts = parts.subspan(1);
+        }
+        if (remaining > 0) {
+            parts.front().iov_base = static_cast<char *>(parts.front().iov_base) + remaining;
+            parts.front().iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+/**
+ * Throws std::runtime_error if the pixels of an image start inside its header, e.g. the zeroed header of an image that
+ * failed to load, whose padding length would wrap around.
+ */
+void check_pixel_offset(Bmp::BmpHeader const &header) {
+    if (header.offset < sizeof(header)) {
+        throw std::runtime_error("The pixels of a bmp image can not start inside its header.\n");
+    }
+}
+
+/**
+ * The header, the padding up to the first pixel and the pixels of an image as parts of one write.
+ */
+std::vector<iovec> image_parts(Bmp::BmpHeader const &header, std::span<const std::byte> pixels) {
+    check_pixel_offset(header);
+    std::vector<iovec> ret{{const_cast<Bmp::BmpHeader *>(&header), sizeof(header)}};
+    for (std::size_t padding = header.offset - sizeof(header); padding > 0;) {
+        std::size_t const size = std::min(padding, zeros.size());
+        ret.push_back({const_cast<std::byte *>(zeros.data()), size});
+        padding -= size;
+    }
+    ret.push_back({const_cast<std::byte *>(pixels.data()), pixels.size()});
+    return ret;
+}
+
+/**
+ * Writes an image through O_DIRECT. The file is assembled in a page aligned staging buffer, written in whole blocks
+ * with the last one padded, then truncated to its real size.
+ *
+ * @return Whether the image was written, false without any error if the file system does not support O_DIRECT.
+ */
+bool write_direct(std::filesystem::path const &path, Bmp::BmpHeader const &header, std::span<const std::byte> pixels) {
+    constexpr std::size_t block = AlignedBuffer::page;
+    constexpr std::size_t staging_size = std::size_t{4} << 20;
+    int const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        if (errno == EINVAL) { return false; }
+        throw std::runtime_error("File " + path.string() + " failed to open.\n");
+    }
+    AlignedBuffer staging{staging_size};
+    auto const buffer = staging.getBytes();
+    std::size_t const total = header.offset + pixels.size();
+    for (std::size_t position = 0; position < total; position += staging_size) {
+        std::size_t const size = std::min(staging_size, total - position);
+        // the file is the header, the zero padding and the pixels one after the other
+        std::size_t filled = 0;
+        if (position < header.offset) {
+            auto const start = buffer.first(header.offset);
+            Bmp::write_header(start, header);
+            filled = header.offset;
+        }
+        std::size_t const from = position + filled - header.offset;
+        std::copy_n(pixels.begin() + static_cast<std::ptrdiff_t>(from), size - filled, buffer.begin() + filled);
+        std::size_t const padded = (size + block - 1) / block * block;
+        std::fill(buffer.begin() + size, buffer.begin() + padded, std::byte{0});
+        if (::pwrite(fd, buffer.data(), padded, static_cast<off_t>(position)) != static_cast<ssize_t>(padded)) {
+            auto const error = errno;
+            ::close(fd);
+            if (error == EINVAL && position == 0) { return false; }
+            throw std::runtime_error("File " + path.string() + " failed to write.\n");
+        }
+    }
+    bool const truncated = ::ftruncate(fd, static_cast<off_t>(total)) == 0;
+    ::close(fd);
+    if (!truncated) {
+        throw std::runtime_error("File " + path.string() + " failed to write.\n");
+    }
+    return true;
+}
+
+}
+
+
+void Bmp::load_image(const std::filesystem::path &image_path) {
     if (is_regular_file(image_path)) {
         auto image = std::ifstream{image_path, std::ios::binary | std::ios::ate};
-        if (!image) { return {}; }
-        auto const size = image.tellg();
+        if (!image) { return; }
+        auto const size = static_cast<std::size_t>(image.tellg());
         image.seekg({}, std::ios::beg);
-        std::vector<std::byte> ret(size);
-        image.read(reinterpret_cast<char *>(ret.data()), size);
-        return ret;
+        image.read(reinterpret_cast<char *>(&header), header_size);
+        if (!image || header.signature != 0x4d42 || header.offset < header_size || header.offset > size) {
+            throw std::runtime_error("File " + image_path.string() + " is not a readable bmp image.\n");
+        }
+        image.seekg(header.offset, std::ios::beg);
+        pixel_data.resize(size - header.offset);
+        image.read(reinterpret_cast<char *>(pixel_data.data()), static_cast<std::streamsize>(pixel_data.size()));
+    }
+}
+
+void Bmp::map_image(const std::filesystem::path &image_path) {
+    auto file = std::make_shared<const MappedFile>(image_path);
+    auto const bytes = file->getBytes();
+    if (bytes.size() < header_size) {
+        throw std::runtime_error("File " + image_path.string() + " is too small to be a bmp image.\n");
+    }
+    std::copy(bytes.begin(), bytes.begin() + header_size, reinterpret_cast<std::byte *>(&header));
+    if (header.signature != 0x4d42 || header.offset < header_size || header.offset > bytes.size()) {
+        throw std::runtime_error("File " + image_path.string() + " is not a readable bmp image.\n");
     }
-    return {};
+    mapping = std::move(file);
 }
 
-Bmp::Bmp(const std::filesystem::path &image_path) {
+Bmp::Bmp(const std::filesystem::path &image_path, LoadMode mode) : source(image_path) {
+    // a mapped image is only mapped here, its pages are read when a kernel first touches them
+    TRACE_SCOPE("load");
     try {
         if (image_path.extension() != ".bmp") {
             throw std::runtime_error("Invalid file type.\n");
 
         }
-        auto image = load_image(image_path);
-        if (!image.empty()) {
-            std::copy(image.begin(), image.begin() + header_size, reinterpret_cast<std::byte *>(&header));
-            pixel_data.resize(image.size() - header.offset);
-            std::copy(image.begin() + header.offset, image.end(), pixel_data.data());
+        if (mode == LoadMode::map) {
+            map_image(image_path);
+            return;
         }
+        load_image(image_path);
     } catch (std::exception &e) {
+        // a partly read header must not look like an image, writing an empty image throws on its zero offset
+        header = {};
         std::cerr << e.what() << std::endl;
     }
 
 }
 
+const std::filesystem::path &Bmp::getSource() const {
+    return source;
+}
+
 const Bmp::BmpHeader &Bmp::getHeader() const {
     return header;
 }
@@ -47,20 +183,150 @@ const std::vector<std::byte> &Bmp::getPixelData() const {
     return pixel_data;
 }
 
+std::span<const std::byte> Bmp::getPixels() const {
+    if (mapping) {
+        return mapping->getBytes().subspan(header.offset);
+    }
+    if (buffer) {
+        return buffer->getBytes();
+    }
+    return pixel_data;
+}
+
 
 Bmp::Bmp(const Bmp::BmpHeader &header, const std::vector<std::byte> &pixelData) : header(header),
                                                                                   pixel_data(pixelData) {}
 
-std::filesystem::path Bmp::write_image(const std::filesystem::path &path) {
+Bmp::Bmp(const Bmp::BmpHeader &header, std::vector<std::byte> &&pixelData) : header(header),
+                                                                             pixel_data(std::move(pixelData)) {}
+
+Bmp::Bmp(const Bmp::BmpHeader &header, AlignedBuffer &&pixels) : header(header),
+                                                                 buffer(std::make_shared<const AlignedBuffer>(std::move(pixels))) {}
+
+Bmp::Bmp(const Bmp::BmpHeader &header, std::shared_ptr<const AlignedBuffer> pixels) : header(header),
+                                                                                      buffer(std::move(pixels)) {}
+
+std::filesystem::path Bmp::write_image(const std::filesystem::path &path, WriteMode mode) const {
+    if (mode == WriteMode::stream && !is_standard_output(path)) { return write_image(path); }
+    TRACE_SCOPE("write");
+    try {
+        // checked before the file is created, so a failed write leaves no empty file behind
+        check_pixel_offset(header);
+        auto const pixels = getPixels();
+        if (is_standard_output(path)) {
+            auto parts = image_parts(header, pixels);
+            if (!write_parts(STDOUT_FILENO, parts, std::nullopt)) {
+                throw std::runtime_error("The standard output failed to write.\n");
+            }
+            return path;
+        }
+        if (path.extension() != ".bmp") {
+            throw std::runtime_error("File " + path.string() + " is not a .bmp file.\n");
+        }
+        detach_output(path);
+        if (mode == WriteMode::map) {
+            OutputFile out{path, header.offset + pixels.size()};
+            write_header(out.getBytes(), header);
+            std::copy(pixels.begin(), pixels.end(), out.getBytes().begin() + header.offset);
+            return path;
+        }
+        if (mode == WriteMode::direct && write_direct(path, header, pixels)) {
+            return path;
+        }
+        int const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("File " + path.string() + " failed to open.\n");
+        }
+        auto parts = image_parts(header, pixels);
+        bool const written = write_parts(fd, parts, off_t{0});
+        ::close(fd);
+        if (!written) {
+            throw std::runtime_error("File " + path.string() + " failed to write.\n");
+        }
+        return path;
+    } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return {};
+    }
+}
+
+Bmp::Bmp(const std::filesystem::path &image_path, const Region &region) {
+    TRACE_SCOPE("load region");
+    int const fd = ::open(image_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("File " + image_path.string() + " failed to open.\n");
+    }
+    auto const read_at = [&](std::byte *data, std::size_t size, std::size_t position) {
+        while (size > 0) {
+            auto const count = ::pread(fd, data, size, static_cast<off_t>(position));
+            if (count < 0 && errno == EINTR) { continue; }
+            if (count <= 0) { return false; }
+            data += count;
+            size -= static_cast<std::size_t>(count);
+            position += static_cast<std::size_t>(count);
+        }
+        return true;
+    };
+    BmpHeader file_header{};
+    bool const valid = read_at(reinterpret_cast<std::byte *>(&file_header), sizeof(file_header), 0) &&
+                       file_header.signature == 0x4d42 && file_header.offset >= sizeof(file_header) &&
+                       file_header.bits_per_pixel >= 8 && file_header.bits_per_pixel % 8 == 0;
+    if (!valid) {
+        ::close(fd);
+        throw std::runtime_error("File " + image_path.string() + " is not a readable bmp image.\n");
+    }
+    std::size_t const image_width = std::abs(file_header.width);
+    std::size_t const image_height = std::abs(file_header.height);
+    if (region.width == 0 || region.height == 0 || std::size_t{region.x} + region.width > image_width ||
+        std::size_t{region.y} + region.height > image_height) {
+        ::close(fd);
+        throw std::runtime_error("The region is empty or not inside " + image_path.string() + ".\n");
+    }
+
+    std::size_t const bytes_per_pixel = file_header.bits_per_pixel / 8u;
+    std::size_t const file_row_size = (image_width * bytes_per_pixel + 3) & ~std::size_t{3};
+    header = make_header(static_cast<int32_t>(region.width),
+                         file_header.height < 0 ? -static_cast<int32_t>(region.height)
+                                                : static_cast<int32_t>(region.height),
+                         file_header.bits_per_pixel);
+    std::size_t const row_size = header.image_size / region.height;
+    std::size_t const segment = region.width * bytes_per_pixel;
+    // rows are stored bottom-up unless the height is negative, either way the rectangle is one run of file rows
+    std::size_t const first_row = file_header.height < 0 ? region.y : image_height - region.y - region.height;
+    std::size_t const start = file_header.offset + first_row * file_row_size + region.x * bytes_per_pixel;
+
+    auto pixels = std::make_shared<AlignedBuffer>(header.image_size);
+    auto const bytes = pixels->getBytes();
+    bool read = true;
+    if (segment == file_row_size && row_size == file_row_size) {
+        read = read_at(bytes.data(), bytes.size(), start);
+    } else {
+        for (std::size_t row = 0; row < region.height && read; ++row) {
+            read = read_at(bytes.data() + row * row_size, segment, start + row * file_row_size);
+            std::fill(bytes.begin() + row * row_size + segment, bytes.begin() + (row + 1) * row_size, std::byte{0});
+        }
+    }
+    ::close(fd);
+    if (!read) {
+        throw std::runtime_error("File " + image_path.string() + " ended before the rows of the region.\n");
+    }
+    buffer = std::move(pixels);
+}
+
+bool Bmp::is_standard_output(const std::filesystem::path &path) {
+    return path == "-";
+}
+
+std::filesystem::path Bmp::write_image(const std::filesystem::path &path) const {
+    TRACE_SCOPE("write");
     try {
+        check_pixel_offset(header);
         if (path.extension() == ".bmp") {
+            detach_output(path);
             std::ofstream out{path, std::ios::binary};
             if (out.is_open()) {
-                out.write(reinterpret_cast<char *>(&header), sizeof(header));
-                std::vector<std::byte> offset_fill(header.offset - sizeof(header));
-                std::fill(offset_fill.begin(), offset_fill.end(), std::byte{0x00});
-                out.write(reinterpret_cast<char *>(offset_fill.data()), header.offset - sizeof(header));
-                auto pixels = std::span<const std::byte>(std::move(pixel_data));
+                write_header(out, header);
+                auto pixels = getPixels();
                 out.write(reinterpret_cast<const char *>(pixels.data()), pixels.size());
                 return path;
             } else {
@@ -74,3 +340,59 @@ std::filesystem::path Bmp::write_image(const std::filesystem::path &path) {
         return {};
     }
 }
+
+void Bmp::detach_output(const std::filesystem::path &path) {
+    struct stat status{};
+    if (lstat(path.c_str(), &status) == 0 && S_ISREG(status.st_mode) && status.st_nlink > 1) {
+        std::filesystem::remove(path);
+    }
+}
+
+Bmp::BmpHeader Bmp::read_header(std::istream &in) {
+    BmpHeader ret{};
+    in.read(reinterpret_cast<char *>(&ret), sizeof(ret));
+    if (!in || ret.offset < sizeof(ret)) {
+        throw std::runtime_error("Stream ended before the bmp header.\n");
+    }
+    in.ignore(ret.offset - sizeof(ret));
+    if (!in) {
+        throw std::runtime_error("Stream ended before the bmp pixels.\n");
+    }
+    return ret;
+}
+
+void Bmp::write_header(std::ostream &out, const Bmp::BmpHeader &header) {
+    check_pixel_offset(header);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (std::size_t padding = header.offset - sizeof(header); padding > 0;) {
+        std::size_t const size = std::min(padding, zeros.size());
+        out.write(reinterpret_cast<const char *>(zeros.data()), static_cast<std::streamsize>(size));
+        padding -= size;
+    }
+}
+
+void Bmp::write_header(std::span<std::byte> out, const Bmp::BmpHeader &header) {
+    check_pixel_offset(header);
+    if (out.size() < header.offset) {
+        throw std::runtime_error("The buffer is too small for the bmp header.\n");
+    }
+    std::memcpy(out.data(), &header, sizeof(header));
+    std::fill(out.begin() + sizeof(header), out.begin() + header.offset, std::byte{0});
+}
+
+Bmp::BmpHeader Bmp::make_header(int32_t width, int32_t height, uint16_t bits_per_pixel) {
+    BmpHeader ret{};
+    auto const row_size = static_cast<uint32_t>((width * bits_per_pixel / 8 + 3) & ~3);
+    ret.signature = 0x4d42;
+    ret.offset = sizeof(BmpHeader);
+    ret.header_size = 40;
+    ret.width = width;
+    ret.height = height;
+    ret.planes = 1;
+    ret.bits_per_pixel = bits_per_pixel;
+    ret.image_size = row_size * static_cast<uint32_t>(height < 0 ? -height : height);
+    ret.file_size = ret.offset + ret.image_size;
+    ret.x_pixels_per_meter = 2835;
+    ret.y_pixels_per_meter = 2835;
+    return ret;
+}
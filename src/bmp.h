@@ -5,9 +5,38 @@
 #include <cstddef>
 #include <vector>
 #include <filesystem>
+#include <memory>
+#include <span>
 #include <omp.h>
+#include "aligned_buffer.h"
+#include "mapped_file.h"
 
 class Bmp {
+public:
+    /**
+ * How the file of an image is brought into memory. read copies the pixels into an owned vector,
+ * map memory-maps the file and exposes its pixels without copying them.
+ */
+    enum class LoadMode { read, map };
+
+/**
+ * How an image is written to its file. stream writes through an ofstream, vectored writes the header, the padding
+ * and the pixels with one pwritev call, map stores the image into a shared mapping of the preallocated file, and
+ * direct writes through O_DIRECT in page aligned blocks, bypassing the page cache. direct falls back to vectored on
+ * file systems without O_DIRECT support.
+ */
+    enum class WriteMode { stream, vectored, map, direct };
+
+/**
+ * A rectangle of an image in pixels, with y counted from the top row as the image is displayed.
+ */
+    struct Region {
+        uint32_t x{};
+        uint32_t y{};
+        uint32_t width{};
+        uint32_t height{};
+    };
+
 #pragma pack(push, 1)
     struct BmpHeader {
         [[maybe_unused]] uint16_t signature;
@@ -27,27 +56,50 @@ class Bmp {
         [[maybe_unused]] uint32_t colors_used;
         [[maybe_unused]] uint32_t important_colors;
     };
-    const std::size_t header_size = 54;
+#pragma pack(pop)
+
+private:
+    static constexpr std::size_t header_size = 54;
     BmpHeader header{};
     std::vector<std::byte> pixel_data{};
+    std::shared_ptr<const MappedFile> mapping{};
+    std::shared_ptr<const AlignedBuffer> buffer{};
+    std::filesystem::path source{};
 
-#pragma pack(pop)
+/**
+ * Reads the header and the pixels of an image file straight into this object, without an intermediate copy of the file.
+ *
+ * @param image_path The path of the image file to load. Leaves the image empty if it is not a regular file.
+ */
+    void load_image(std::filesystem::path const &image_path);
 
 /**
- * Load an image from a file path into a vector of bytes.
+ * Memory-maps an image file and copies only its header.
  *
- * @param image_path The path of the image file to load.
- * @return A vector of bytes representing the loaded image, or an empty vector if loading failed.
+ * @param image_path The path of the image file to map.
  */
-    std::vector<std::byte> load_image(std::filesystem::path const &image_path);
+    void map_image(std::filesystem::path const &image_path);
 
 public:
     /**
  * Constructs a BMP object by loading an image from a file.
  *
  * @param image_path The path of the BMP image file to load.
+ * @param mode       Whether the pixels are copied into memory or mapped straight from the file.
+ */
+    explicit Bmp(std::filesystem::path const &image_path, LoadMode mode = LoadMode::read);
+
+    /**
+ * Constructs a BMP object holding a rectangle of an image file. The offsets of the rows are computed from the header
+ * and only the bytes of the rectangle are read, one pread per row or a single one if the rectangle spans whole rows,
+ * so the cost depends on the area of the rectangle and not on the size of the file. The result is a complete image
+ * of the rectangle's size with padded rows and the orientation of the file.
+ * Throws std::runtime_error if the file is not a readable bmp image or the region is not inside it.
+ *
+ * @param image_path The path of the BMP image file to read from.
+ * @param region     The rectangle to read.
  */
-    explicit Bmp(std::filesystem::path const &image_path);
+    Bmp(std::filesystem::path const &image_path, Region const &region);
 
     /**
  * Constructs a BMP object with the given BMP header and pixel data.
@@ -57,6 +109,31 @@ public:
  */
     Bmp(const BmpHeader &header, const std::vector<std::byte> &pixelData);
 
+    /**
+ * Constructs a BMP object that takes over the given pixel data without copying it.
+ *
+ * @param header The BMP header data.
+ * @param pixelData The pixel data.
+ */
+    Bmp(const BmpHeader &header, std::vector<std::byte> &&pixelData);
+
+    /**
+ * Constructs a BMP object that takes ownership of an aligned pixel buffer.
+ *
+ * @param header  The BMP header data.
+ * @param pixels  The pixel data.
+ */
+    Bmp(const BmpHeader &header, AlignedBuffer &&pixels);
+
+    /**
+ * Constructs a BMP object that shares an aligned pixel buffer, e.g. one handed out by a BufferPool.
+ * The buffer stays in use until this object and all of its copies are destroyed.
+ *
+ * @param header  The BMP header data.
+ * @param pixels  The pixel data.
+ */
+    Bmp(const BmpHeader &header, std::shared_ptr<const AlignedBuffer> pixels);
+
     /**
  * Gets the BMP header data of the loaded image.
  *
@@ -67,15 +144,92 @@ public:
 /**
  * Gets the pixel data of the loaded image.
  *
- * @return A reference to the vector of bytes representing the pixel data.
+ * @return A reference to the vector of bytes representing the pixel data, empty for mapped or aligned images.
  */
     [[nodiscard]] const std::vector<std::byte> &getPixelData() const;
 
+/**
+ * Gets the pixels of the image, regardless of whether they were read into memory or mapped from the file.
+ *
+ * @return A span over the pixel bytes, valid for the lifetime of this object and its copies.
+ */
+    [[nodiscard]] std::span<const std::byte> getPixels() const;
+
+/**
+ * Gets the path of the file the image was loaded from, which a mapped image keeps reading from while it is merged.
+ *
+ * @return The path given to the constructor, or an empty path for images that were built in memory.
+ */
+    [[nodiscard]] const std::filesystem::path &getSource() const;
+
     /**
  * Writes the BMP image to a file at the given path.
  *
  * @param path The path of the file to write the BMP image to.
  * @return The path of the file that was written to, or an empty path if writing failed.
  */
-    std::filesystem::path write_image(std::filesystem::path const &path);
+    std::filesystem::path write_image(std::filesystem::path const &path) const;
+
+    /**
+ * Writes the BMP image to a file at the given path, or to the standard output if the path is "-".
+ *
+ * @param path  The path of the file to write the BMP image to.
+ * @param mode  How the file is written, the standard output is always written with vectored writes.
+ * @return The path of the file that was written to, or an empty path if writing failed.
+ */
+    std::filesystem::path write_image(std::filesystem::path const &path, WriteMode mode) const;
+
+/**
+ * Gets whether an output path stands for the standard output, which is written as a stream of bytes, e.g. to a pipe.
+ *
+ * @param path The output path.
+ * @return Whether the path is "-".
+ */
+    static bool is_standard_output(std::filesystem::path const &path);
+
+/**
+ * Writes the header of an image followed by zeros up to the offset of the first pixel into the start of a buffer.
+ * Throws std::runtime_error if the offset lies inside the header or beyond the buffer, e.g. for an image that
+ * failed to load.
+ *
+ * @param out     The buffer, at least header.offset bytes.
+ * @param header  The header to write.
+ */
+    static void write_header(std::span<std::byte> out, BmpHeader const &header);
+
+/**
+ * Removes a regular file that has other hard links, so that writing a new file at its path leaves them unchanged,
+ * e.g. a cached result that was hard-linked to this output earlier.
+ *
+ * @param path The path of the output file about to be written.
+ */
+    static void detach_output(std::filesystem::path const &path);
+
+/**
+ * Reads a BMP header from the current position of a stream and skips to the first pixel.
+ * Throws std::runtime_error if the stream ends before the pixels start.
+ *
+ * @param in The stream to read from, positioned at the start of a BMP file.
+ * @return The header that was read.
+ */
+    static BmpHeader read_header(std::istream &in);
+
+/**
+ * Writes a BMP header to a stream, followed by zeros up to the offset of the first pixel.
+ * Throws std::runtime_error if the offset lies inside the header.
+ *
+ * @param out     The stream to write to.
+ * @param header  The header to write.
+ */
+    static void write_header(std::ostream &out, BmpHeader const &header);
+
+/**
+ * Creates the header of an uncompressed bottom-up BMP image whose rows are padded to four bytes.
+ *
+ * @param width           The width of the image in pixels.
+ * @param height          The height of the image in pixels.
+ * @param bits_per_pixel  The number of bits per pixel, 24 or 32.
+ * @return The header, with the pixels starting right after it.
+ */
+    static BmpHeader make_header(int32_t width, int32_t height, uint16_t bits_per_pixel = 24);
 };
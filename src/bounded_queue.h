@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+/**
+ * A blocking multi-producer multi-consumer queue with a fixed capacity, used to connect pipeline stages.
+ * Producers wait while the queue is full, consumers wait while it is empty and not closed.
+ */
+template<typename T>
+class BoundedQueue {
+    std::mutex mutex{};
+    std::condition_variable not_full{};
+    std::condition_variable not_empty{};
+    std::deque<T> items{};
+    std::size_t capacity;
+    bool closed{false};
+
+public:
+    explicit BoundedQueue(std::size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    /**
+ * Adds an item, waiting for free space if the queue is full.
+ *
+ * @param item The item to add.
+ * @return False if the queue was closed and the item was dropped.
+ */
+    bool push(T item) {
+        std::unique_lock lock{mutex};
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) { return false; }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    /**
+ * Removes the oldest item, waiting for one if the queue is empty.
+ *
+ * @return The item, or an empty optional once the queue is closed and drained.
+ */
+    std::optional<T> pop() {
+        std::unique_lock lock{mutex};
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) { return std::nullopt; }
+        T item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return item;
+    }
+
+    /**
+ * Closes the queue. Waiting producers give up and consumers drain the remaining items.
+ */
+    void close() {
+        std::lock_guard lock{mutex};
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+};
@@ -0,0 +1,94 @@
+#include <new>
+#include "buffer_pool.h"
+
+BufferPool::State::State(std::size_t alignment, std::size_t free_limit) : alignment(alignment),
+                                                                          free_limit(free_limit) {}
+
+BufferPool::State::~State() {
+    for (auto *block: blocks) { ::operator delete(block); }
+}
+
+void BufferPool::State::give_back(std::unique_ptr<AlignedBuffer> buffer) {
+    std::lock_guard lock{mutex};
+    --leased;
+    if (closed || free_count >= free_limit) { return; }
+    try {
+        free[buffer->getBytes().size()].push_back(std::move(buffer));
+        ++free_count;
+    } catch (std::bad_alloc &) {
+        // a buffer that can not be listed as free is simply freed
+    }
+}
+
+void *BufferPool::State::take_block(std::size_t size) {
+    {
+        std::lock_guard lock{mutex};
+        if (size == block_size && !blocks.empty()) {
+            auto *block = blocks.back();
+            blocks.pop_back();
+            return block;
+        }
+    }
+    return ::operator new(size);
+}
+
+void BufferPool::State::give_block(void *block, std::size_t size) {
+    std::lock_guard lock{mutex};
+    // every control block of the pool has the same type, so the first size is the only one
+    if (block_size == 0) { block_size = size; }
+    if (size == block_size) {
+        try {
+            blocks.push_back(block);
+            return;
+        } catch (std::bad_alloc &) {}
+    }
+    ::operator delete(block);
+}
+
+void BufferPool::Return::operator()(AlignedBuffer *buffer) const {
+    state->give_back(std::unique_ptr<AlignedBuffer>{buffer});
+}
+
+BufferPool::BufferPool(std::size_t alignment, std::size_t free_limit)
+        : state(std::make_shared<State>(alignment, free_limit)) {}
+
+BufferPool::~BufferPool() {
+    std::lock_guard lock{state->mutex};
+    // leases still out keep the state alive and are freed when they return
+    state->closed = true;
+    state->free.clear();
+    state->free_count = 0;
+}
+
+std::shared_ptr<AlignedBuffer> BufferPool::acquire(std::size_t size) {
+    std::unique_ptr<AlignedBuffer> buffer{};
+    {
+        std::lock_guard lock{state->mutex};
+        if (auto const free = state->free.find(size); free != state->free.end() && !free->second.empty()) {
+            buffer = std::move(free->second.back());
+            free->second.pop_back();
+            --state->free_count;
+        }
+        ++state->leased;
+    }
+    try {
+        if (!buffer) { buffer = std::make_unique<AlignedBuffer>(size, state->alignment); }
+    } catch (...) {
+        std::lock_guard lock{state->mutex};
+        --state->leased;
+        throw;
+    }
+    // the deleter takes the buffer back even if the control block can not be allocated
+    return {buffer.release(), Return{state}, BlockAllocator<AlignedBuffer>{state}};
+}
+
+void BufferPool::trim() {
+    std::lock_guard lock{state->mutex};
+    state->free.clear();
+    state->free_count = 0;
+}
+
+std::size_t BufferPool::size() const {
+    std::lock_guard lock{state->mutex};
+    return state->leased + state->free_count;
+}
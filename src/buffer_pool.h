@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "aligned_buffer.h"
+
+/**
+ * Hands out aligned buffers and takes them back once nobody uses them anymore, so repeated work on images of the
+ * same size reuses the same memory instead of allocating and faulting in fresh pages every time.
+ * Every buffer that is handed out is a lease, which the deleter of its shared_ptr returns to the free buffers of its
+ * size under the pool's mutex when the last copy is released, on any thread. The shared_ptr control blocks are
+ * recycled as well, so a steady state does not allocate. Leases may outlive the pool, they are freed on return then.
+ */
+class BufferPool {
+    struct State {
+        std::mutex mutex{};
+        std::size_t alignment{};
+        std::size_t free_limit{};
+        std::size_t leased{};
+        std::size_t free_count{};
+        bool closed{false};
+        std::map<std::size_t, std::vector<std::unique_ptr<AlignedBuffer>>> free{};
+        std::vector<void *> blocks{};
+        std::size_t block_size{0};
+
+        State(std::size_t alignment, std::size_t free_limit);
+
+        State(State const &) = delete;
+
+        State &operator=(State const &) = delete;
+
+        ~State();
+
+        void give_back(std::unique_ptr<AlignedBuffer> buffer);
+
+        void *take_block(std::size_t size);
+
+        void give_block(void *block, std::size_t size);
+    };
+
+    struct Return {
+        std::shared_ptr<State> state;
+
+        void operator()(AlignedBuffer *buffer) const;
+    };
+
+    template<typename T>
+    struct BlockAllocator {
+        using value_type = T;
+
+        std::shared_ptr<State> state;
+
+        explicit BlockAllocator(std::shared_ptr<State> state) : state(std::move(state)) {}
+
+        template<typename U>
+        explicit BlockAllocator(BlockAllocator<U> const &other) : state(other.state) {}
+
+        T *allocate(std::size_t count) { return static_cast<T *>(state->take_block(count * sizeof(T))); }
+
+        void deallocate(T *block, std::size_t count) { state->give_block(block, count * sizeof(T)); }
+
+        template<typename U>
+        bool operator==(BlockAllocator<U> const &other) const { return state == other.state; }
+    };
+
+    std::shared_ptr<State> state;
+
+public:
+    /**
+ * Constructs an empty pool.
+ *
+ * @param alignment   The alignment of every buffer, AlignedBuffer::cache_line, page or huge_page.
+ * @param free_limit  The most free buffers the pool keeps, of all sizes together. A buffer returned beyond it is freed.
+ */
+    explicit BufferPool(std::size_t alignment = AlignedBuffer::page, std::size_t free_limit = 16);
+
+    BufferPool(BufferPool const &) = delete;
+
+    BufferPool &operator=(BufferPool const &) = delete;
+
+    ~BufferPool();
+
+    /**
+ * Gets a free buffer of exactly the given size, allocating a new one only if none of that size is free.
+ * The contents of a reused buffer are whatever its previous user left in it.
+ *
+ * @param size The number of bytes.
+ * @return The buffer, leased to the caller until the returned pointer and all its copies are released.
+ */
+    std::shared_ptr<AlignedBuffer> acquire(std::size_t size);
+
+    /**
+ * Releases every buffer that is currently free.
+ */
+    void trim();
+
+    /**
+ * Gets the number of buffers owned by the pool, both free and leased.
+ *
+ * @return The number of buffers.
+ */
+    [[nodiscard]] std::size_t size() const;
+};
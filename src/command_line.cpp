@@ -0,0 +1,210 @@
+#include <limits>
+#include <sstream>
+#include <string_view>
+#include "command_line.h"
+
+std::vector<std::string> split_arguments(const std::vector<std::string> &command_line,
+                                         std::map<std::string, std::string> &options) {
+    std::vector<std::string> ret{};
+    for (std::size_t i = 0; i < command_line.size(); ++i) {
+        auto const &argument = command_line[i];
+        if (i > 0 && argument.starts_with("--")) {
+            auto const separator = argument.find('=');
+            options[argument.substr(2, separator - 2)] = separator == std::string::npos ? "" : argument.substr(separator + 1);
+        } else {
+            ret.push_back(argument);
+        }
+    }
+    return ret;
+}
+
+bool parse_weights(const std::string &list, std::vector<float> &weights) {
+    std::stringstream in{list};
+    for (std::string weight; std::getline(in, weight, ',');) {
+        if (!parse_number(weight, weights.emplace_back())) { return false; }
+    }
+    return true;
+}
+
+bool parse_merge_options(const std::map<std::string, std::string> &options, MergeOptions &merge_options,
+                         std::ostream &err) {
+    auto const option = [&](std::string const &name) {
+        auto const found = options.find(name);
+        return found == options.end() ? std::string{} : found->second;
+    };
+    auto const number = [&](std::string const &name, auto &value) {
+        if (!parse_number(option(name), value)) {
+            err << "Invalid value for --" << name << ".\n";
+            return false;
+        }
+        return true;
+    };
+    if (options.contains("rounding")) {
+        if (option("rounding") == "nearest") {
+            merge_options.rounding = Rounding::nearest;
+        } else if (option("rounding") != "truncate") {
+            err << "Rounding must be <truncate> or <nearest>.\n";
+            return false;
+        }
+    }
+
+    if (options.contains("load")) {
+        if (option("load") == "read") {
+            merge_options.load_mode = Bmp::LoadMode::read;
+        } else if (option("load") == "async") {
+            merge_options.async_load = true;
+        } else if (option("load") != "map") {
+            err << "Load mode must be <read>, <map> or <async>.\n";
+            return false;
+        }
+    }
+
+    if (options.contains("io")) {
+        if (option("io") == "threads") {
+            merge_options.async_backend = AsyncBackend::threads;
+        } else if (option("io") != "uring") {
+            err << "Async I/O backend must be <uring> or <threads>.\n";
+            return false;
+        }
+    }
+
+    if (options.contains("threads")) {
+        if (!number("threads", merge_options.parallel.threads)) { return false; }
+        if (merge_options.parallel.threads < 0) {
+            err << "The number of threads must not be negative, 0 keeps the OpenMP default.\n";
+            return false;
+        }
+    }
+    if (options.contains("schedule")) {
+        if (option("schedule") == "guided") {
+            merge_options.parallel.schedule = Schedule::guided;
+        } else if (option("schedule") != "static") {
+            err << "Schedule must be <static> or <guided>.\n";
+            return false;
+        }
+    }
+    if (options.contains("no-pin")) {
+        merge_options.parallel.pin = false;
+    }
+    if (options.contains("band-rows")) {
+        if (!number("band-rows", merge_options.band_rows)) { return false; }
+    }
+    if (options.contains("write")) {
+        if (option("write") == "vectored") {
+            merge_options.write_mode = Bmp::WriteMode::vectored;
+        } else if (option("write") == "map") {
+            merge_options.write_mode = Bmp::WriteMode::map;
+        } else if (option("write") == "direct") {
+            merge_options.write_mode = Bmp::WriteMode::direct;
+        } else if (option("write") != "stream") {
+            err << "Write mode must be <stream>, <vectored>, <map> or <direct>.\n";
+            return false;
+        }
+    }
+    if (options.contains("resample")) {
+        auto const resample = resample_from_name(option("resample"));
+        if (!resample) {
+            err << "Resampling must be <none>, <nearest>, <bilinear> or <box>.\n";
+            return false;
+        }
+        merge_options.resample = *resample;
+    }
+    if (options.contains("roi")) {
+        Bmp::Region region{};
+        char separator[3]{};
+        std::istringstream list{option("roi")};
+        list >> region.x >> separator[0] >> region.y >> separator[1] >> region.width >> separator[2] >> region.height;
+        if (!list || !list.eof() || std::string_view{separator, 3} != ",,," || region.width == 0 ||
+            region.height == 0) {
+            err << "The region must be written as --roi=x,y,width,height with a width and height above zero.\n";
+            return false;
+        }
+        merge_options.region = region;
+    }
+    if (options.contains("preview")) {
+        if (!number("preview", merge_options.preview)) { return false; }
+        if (merge_options.preview != 1 && merge_options.preview != 2 && merge_options.preview != 4 &&
+            merge_options.preview != 8) {
+            err << "The preview factor must be 1, 2, 4 or 8.\n";
+            return false;
+        }
+    }
+    if (options.contains("mask")) {
+        merge_options.mask = option("mask");
+    }
+    if (options.contains("tile")) {
+        if (!number("tile", merge_options.tile_size)) { return false; }
+    }
+    if (options.contains("frame-group")) {
+        if (!number("frame-group", merge_options.frame_group)) { return false; }
+    }
+    if (options.contains("result-cache")) {
+        merge_options.result_cache = option("result-cache");
+    }
+    if (options.contains("result-cache-mb")) {
+        std::size_t megabytes{};
+        if (!number("result-cache-mb", megabytes)) { return false; }
+        if (megabytes > std::numeric_limits<std::size_t>::max() >> 20) {
+            err << "Invalid value for --result-cache-mb.\n";
+            return false;
+        }
+        merge_options.result_cache_bytes = megabytes << 20;
+    }
+    return true;
+}
+
+std::optional<MergeCommand> parse_merge_command(const std::vector<std::string> &arguments, std::ostream &err) {
+    if (arguments.size() != 6 && arguments.size() != 7) {
+        err << "Error: Incorrect number of arguments\n";
+        return std::nullopt;
+    }
+    MergeCommand ret{};
+    ret.algorithm = arguments[1];
+    std::size_t i = 0;
+    std::string merge_method{"average"};
+    if (std::filesystem::path{arguments[2]}.extension() != ".bmp") {
+        merge_method = arguments[2];
+        ++i;
+    }
+    if (arguments.size() != 6 + i) {
+        err << "Error: Incorrect number of arguments\n";
+        return std::nullopt;
+    }
+    ret.first = arguments[2 + i];
+    ret.second = arguments[3 + i];
+    ret.output = arguments[4 + i];
+    if (!parse_number(arguments[5 + i], ret.weight) || ret.weight > 1.0 || ret.weight < 0.0) {
+        err << "Weight value must be in range [0.0,1.0].\n";
+        return std::nullopt;
+    }
+    auto const mode = blend_mode_from_name(merge_method);
+    if (!mode) {
+        err << "Unknown merging method " << merge_method << ".\n";
+        return std::nullopt;
+    }
+    ret.mode = *mode;
+    return ret;
+}
+
+std::optional<SequenceCommand> parse_sequence_command(const std::vector<std::string> &arguments,
+                                                      const std::map<std::string, std::string> &options,
+                                                      std::ostream &err) {
+    if (arguments.size() != 6) {
+        err << "Error: Incorrect number of arguments\n";
+        return std::nullopt;
+    }
+    SequenceCommand ret{arguments[2], arguments[3], arguments[4]};
+    if (!parse_number(arguments[5], ret.frames) || ret.frames < 2) {
+        err << "A sequence needs at least two frames.\n";
+        return std::nullopt;
+    }
+    if (auto const ramp = options.find("ramp"); ramp != options.end()) {
+        auto const parsed = ramp_from_name(ramp->second);
+        if (!parsed) {
+            err << "Unknown ramp " << ramp->second << ".\n";
+            return std::nullopt;
+        }
+        ret.ramp = *parsed;
+    }
+    return ret;
+}
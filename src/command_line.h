@@ -0,0 +1,101 @@
+#pragma once
+
+#include <charconv>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "image_merger.h"
+
+/**
+ * Splits a command line into positional arguments and options written as --name or --name=value.
+ *
+ * @param command_line  The command line, starting with the program name.
+ * @param options       Receives the options, mapped from their name to their value.
+ * @return The positional arguments, including the program name.
+ */
+std::vector<std::string> split_arguments(std::vector<std::string> const &command_line,
+                                         std::map<std::string, std::string> &options);
+
+/**
+ * Parses a number that has to make up the whole text and fit the type, unlike the std::sto* functions, which throw
+ * or stop at the first character that does not belong to a number.
+ *
+ * @param text   The text, e.g. the value of an option.
+ * @param value  Receives the number.
+ * @return Whether the text was a valid number.
+ */
+template<typename Number>
+bool parse_number(std::string const &text, Number &value) {
+    auto const end = text.data() + text.size();
+    auto const [last, error] = std::from_chars(text.data(), end, value);
+    return !text.empty() && error == std::errc{} && last == end;
+}
+
+/**
+ * Parses a comma separated list of weights, e.g. the value of --weights.
+ *
+ * @param list     The list.
+ * @param weights  Receives the weights in order.
+ * @return Whether every weight was a valid number.
+ */
+bool parse_weights(std::string const &list, std::vector<float> &weights);
+
+/**
+ * Applies the options shared by all merges (--rounding, --load, --write, --io, --threads, --schedule, --no-pin,
+ * --band-rows, --tile, --frame-group, --resample, --roi, --preview, --mask, --result-cache, --result-cache-mb).
+ *
+ * @param options        The options of the command line.
+ * @param merge_options  The settings to update.
+ * @param err            Receives a message for an invalid option.
+ * @return Whether all options were valid.
+ */
+bool parse_merge_options(std::map<std::string, std::string> const &options, MergeOptions &merge_options,
+                         std::ostream &err);
+
+/**
+ * A two-image merge as written on the command line.
+ */
+struct MergeCommand {
+    std::string algorithm{};
+    BlendMode mode{BlendMode::average};
+    std::filesystem::path first{};
+    std::filesystem::path second{};
+    std::filesystem::path output{};
+    float weight{0.5f};
+};
+
+/**
+ * Parses the positional arguments <algorithm version> [merging method] <first> <second> <output> <weight>.
+ * The merging method may be left out if the first image path ends in .bmp, average is used then.
+ *
+ * @param arguments  The positional arguments, including the program name.
+ * @param err        Receives a message for an invalid command.
+ * @return The command, or an empty optional if the arguments are invalid.
+ */
+std::optional<MergeCommand> parse_merge_command(std::vector<std::string> const &arguments, std::ostream &err);
+
+/**
+ * A crossfade sequence as written on the command line.
+ */
+struct SequenceCommand {
+    std::filesystem::path first{};
+    std::filesystem::path second{};
+    std::filesystem::path output{};
+    std::size_t frames{};
+    Ramp ramp{Ramp::linear};
+};
+
+/**
+ * Parses the positional arguments sequence <first> <second> <output> <frames> and the --ramp option.
+ *
+ * @param arguments  The positional arguments, including the program name.
+ * @param options    The options of the command line.
+ * @param err        Receives a message for an invalid command.
+ * @return The command, or an empty optional if the arguments are invalid.
+ */
+std::optional<SequenceCommand> parse_sequence_command(std::vector<std::string> const &arguments,
+                                                      std::map<std::string, std::string> const &options,
+                                                      std::ostream &err);
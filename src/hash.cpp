@@ -0,0 +1,83 @@
+#include <bit>
+#include <cstring>
+#include <vector>
+#include "hash.h"
+
+namespace {
+
+constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+template<typename T>
+T read(std::byte const *data) {
+    T ret;
+    std::memcpy(&ret, data, sizeof(ret));
+    return ret;
+}
+
+uint64_t round(uint64_t accumulator, uint64_t input) {
+    return std::rotl(accumulator + input * prime2, 31) * prime1;
+}
+
+uint64_t merge_round(uint64_t hash, uint64_t accumulator) {
+    return (hash ^ round(0, accumulator)) * prime1 + prime4;
+}
+
+}
+
+uint64_t xxh64(std::span<const std::byte> bytes, uint64_t seed) {
+    auto const *data = bytes.data();
+    auto const *const end = data + bytes.size();
+    uint64_t hash;
+    if (bytes.size() >= 32) {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+        for (; end - data >= 32; data += 32) {
+            v1 = round(v1, read<uint64_t>(data));
+            v2 = round(v2, read<uint64_t>(data + 8));
+            v3 = round(v3, read<uint64_t>(data + 16));
+            v4 = round(v4, read<uint64_t>(data + 24));
+        }
+        hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    } else {
+        hash = seed + prime5;
+    }
+    hash += bytes.size();
+
+    for (; end - data >= 8; data += 8) {
+        hash = std::rotl(hash ^ round(0, read<uint64_t>(data)), 27) * prime1 + prime4;
+    }
+    if (end - data >= 4) {
+        hash = std::rotl(hash ^ read<uint32_t>(data) * prime1, 23) * prime2 + prime3;
+        data += 4;
+    }
+    for (; data < end; ++data) {
+        hash = std::rotl(hash ^ std::to_integer<uint64_t>(*data) * prime5, 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t hash_blocks(std::span<const std::byte> bytes, int threads) {
+    constexpr std::size_t block = 1 << 20;
+    std::vector<uint64_t> hashes((bytes.size() + block - 1) / block);
+#pragma omp parallel for num_threads(threads) schedule(static)
+    for (std::size_t i = 0; i < hashes.size(); ++i) {
+        hashes[i] = xxh64(bytes.subspan(i * block, std::min(block, bytes.size() - i * block)));
+    }
+    return xxh64(std::as_bytes(std::span(hashes)), bytes.size());
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/**
+ * The 64-bit xxHash of a buffer, XXH64 in the reference implementation.
+ *
+ * @param bytes  The bytes to hash.
+ * @param seed   The seed of the hash.
+ * @return The hash.
+ */
+uint64_t xxh64(std::span<const std::byte> bytes, uint64_t seed = 0);
+
+/**
+ * Hashes a large buffer in blocks of 1 MiB on several threads and then hashes the block hashes together with the
+ * size. The result does not depend on the number of threads, but differs from xxh64 of the whole buffer.
+ *
+ * @param bytes    The bytes to hash.
+ * @param threads  The number of OpenMP threads.
+ * @return The hash.
+ */
+uint64_t hash_blocks(std::span<const std::byte> bytes, int threads);
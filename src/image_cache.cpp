@@ -0,0 +1,69 @@
+#include <stdexcept>
+#include <sys/stat.h>
+#include "image_cache.h"
+
+std::size_t ImageCache::KeyHash::operator()(const Key &key) const {
+    auto ret = std::hash<std::string>{}(key.path);
+    ret ^= std::hash<int64_t>{}(key.modified) + 0x9e3779b97f4a7c15 + (ret << 6) + (ret >> 2);
+    ret ^= std::hash<uint64_t>{}(key.size) + 0x9e3779b97f4a7c15 + (ret << 6) + (ret >> 2);
+    return ret;
+}
+
+ImageCache::ImageCache(std::size_t capacity) : capacity(capacity) {}
+
+void ImageCache::evict(std::list<Entry>::iterator entry) {
+    stats.bytes -= entry->image->getPixels().size();
+    --stats.entries;
+    ++stats.evictions;
+    index.erase(entry->key);
+    entries.erase(entry);
+}
+
+std::shared_ptr<const Bmp> ImageCache::get(const std::filesystem::path &path) {
+    struct stat status{};
+    if (stat(path.c_str(), &status) != 0) {
+        throw std::runtime_error("File " + path.string() + " failed to open.\n");
+    }
+    Key key{std::filesystem::absolute(path).lexically_normal().string(),
+            static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec,
+            static_cast<uint64_t>(status.st_size)};
+    {
+        std::lock_guard lock{mutex};
+        if (auto const found = index.find(key); found != index.end()) {
+            ++stats.hits;
+            entries.splice(entries.begin(), entries, found->second);
+            return found->second->image;
+        }
+        ++stats.misses;
+    }
+
+    // loaded without holding the lock, a concurrent miss on the same file loads it too and the first insert wins
+    auto image = std::make_shared<const Bmp>(path, Bmp::LoadMode::read);
+    if (image->getPixels().empty()) {
+        throw std::runtime_error("File " + path.string() + " failed to load.\n");
+    }
+    std::size_t const size = image->getPixels().size();
+    if (size > capacity) { return image; }
+
+    std::lock_guard lock{mutex};
+    if (auto const found = index.find(key); found != index.end()) { return found->second->image; }
+    // older versions of the same file can never be hit again
+    for (auto entry = entries.begin(); entry != entries.end();) {
+        auto const next = std::next(entry);
+        if (entry->key.path == key.path) { evict(entry); }
+        entry = next;
+    }
+    while (!entries.empty() && stats.bytes + size > capacity) {
+        evict(std::prev(entries.end()));
+    }
+    entries.push_front(Entry{key, image});
+    index.emplace(std::move(key), entries.begin());
+    stats.bytes += size;
+    ++stats.entries;
+    return image;
+}
+
+ImageCacheStats ImageCache::getStats() const {
+    std::lock_guard lock{mutex};
+    return stats;
+}
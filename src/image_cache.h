@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "bmp.h"
+
+/**
+ * Counters of an ImageCache.
+ */
+struct ImageCacheStats {
+    std::size_t hits{};
+    std::size_t misses{};
+    std::size_t evictions{};
+    std::size_t entries{};
+    std::size_t bytes{};
+};
+
+/**
+ * Keeps recently used decoded images in memory, bounded by the total size of their pixels. An entry is keyed by the
+ * path of its file together with the modification time and size, so a file that changes on disk is loaded again
+ * and its old entry is dropped. The least recently used images are evicted first. Safe to use from many threads.
+ */
+class ImageCache {
+    struct Key {
+        std::string path;
+        int64_t modified;
+        uint64_t size;
+
+        bool operator==(Key const &) const = default;
+    };
+
+    struct KeyHash {
+        std::size_t operator()(Key const &key) const;
+    };
+
+    struct Entry {
+        Key key;
+        std::shared_ptr<const Bmp> image;
+    };
+
+    std::size_t capacity;
+    mutable std::mutex mutex{};
+    std::list<Entry> entries{};
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index{};
+    ImageCacheStats stats{};
+
+    void evict(std::list<Entry>::iterator entry);
+
+public:
+    /**
+ * Constructs an empty cache.
+ *
+ * @param capacity The largest total number of pixel bytes kept in the cache.
+ */
+    explicit ImageCache(std::size_t capacity);
+
+    /**
+ * Gets an image from the cache, or loads it into memory and adds it. An image larger than the whole cache is
+ * returned without being cached. Throws std::runtime_error if the file can not be read.
+ *
+ * @param path The path of the image file.
+ * @return The image, shared with the cache.
+ */
+    std::shared_ptr<const Bmp> get(std::filesystem::path const &path);
+
+    /**
+ * Gets the counters of the cache.
+ *
+ * @return The number of hits, misses and evictions, and the entries and bytes currently cached.
+ */
+    [[nodiscard]] ImageCacheStats getStats() const;
+};
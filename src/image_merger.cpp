@@ -6,201 +6,970 @@
 #include <algorithm>
 #include <span>
 #include <random>
+#include <array>
+#include <future>
+#include <numeric>
 #include "image_merger.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hash.h"
+#include "output_file.h"
+#include "simd_blend.h"
+#include "tile_index.h"
+#include "trace.h"
+
+namespace {
+
+/**
+ * Gets whether an output path names the same file as one of the inputs, which writing it would overwrite before the
+ * input is read.
+ */
+bool is_input(std::filesystem::path const &out_path, std::initializer_list<std::filesystem::path> inputs) {
+    std::error_code error{};
+    return std::any_of(inputs.begin(), inputs.end(), [&](auto const &input) {
+        return std::filesystem::equivalent(out_path, input, error);
+    });
+}
+
+}
+
+ImageMerger::ImageMerger(MergeOptions options) : options(options), engine(options.parallel) {
+    if (!options.result_cache.empty()) {
+        results = std::make_shared<ResultCache>(options.result_cache, options.result_cache_bytes);
+    }
+    if (!options.mask.empty()) {
+        mask = std::make_shared<const Bmp>(options.mask, options.load_mode);
+    }
+}
 
 std::filesystem::path
-ImageMerger::merge_images(int merger, const std::filesystem::path &first, const std::filesystem::path &second,
+ImageMerger::merge_images(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
                           const std::filesystem::path &out_path, float weight) {
+    return merge_files(Algorithm::base, mode, first, second, out_path, weight);
+}
+
+
+std::filesystem::path
+ImageMerger::merge_images_cache(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                                const std::filesystem::path &out_path, float weight) {
+    return merge_files(Algorithm::cache, mode, first, second, out_path, weight);
+}
+
+
+std::filesystem::path
+ImageMerger::merge_images_openmp(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                                 const std::filesystem::path &out_path, float weight) {
+    return merge_files(Algorithm::openmp, mode, first, second, out_path, weight);
+}
+
+
+std::filesystem::path
+ImageMerger::merge_images_optimized(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                                    const std::filesystem::path &out_path, float weight) {
+    return merge_files(Algorithm::optimized, mode, first, second, out_path, weight);
+}
+
+std::filesystem::path
+ImageMerger::merge_images_simd(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                               const std::filesystem::path &out_path, float weight) {
+    return merge_files(Algorithm::simd, mode, first, second, out_path, weight);
+}
+
+Bmp ImageMerger::merge(BlendMode mode, const Bmp &first_image, const Bmp &second_image, float weight,
+                       Algorithm algorithm) {
+    // the dimension check of every kernel is part of this scope and of none of the scopes below it
+    TRACE_SCOPE("merge");
+    auto const blend = FixedWeight::from(weight, options.rounding);
+    if (mask || (options.resample != Resample::none &&
+                 (first_image.getHeader().width != second_image.getHeader().width ||
+                  first_image.getHeader().height != second_image.getHeader().height))) {
+        return merge_simd(mode, blend, first_image, second_image, nullptr);
+    }
+    // the blend mode is resolved once here, every kernel is instantiated for each blend operation
+    switch (algorithm) {
+        case Algorithm::base:
+            return with_blend_op(mode, blend, [&](auto op) { return merge_base(op, first_image, second_image); });
+        case Algorithm::cache:
+            return with_blend_op(mode, blend, [&](auto op) { return merge_cache(op, first_image, second_image); });
+        case Algorithm::openmp:
+            return with_blend_op(mode, blend, [&](auto op) { return merge_openmp(op, first_image, second_image); });
+        case Algorithm::optimized:
+            return with_blend_op(mode, blend, [&](auto op) { return merge_optimized(op, first_image, second_image); });
+        case Algorithm::simd: break;
+    }
+    return merge_simd(mode, blend, first_image, second_image, nullptr);
+}
+
+Bmp ImageMerger::merge(MergeContext &context, BlendMode mode, const Bmp &first_image, const Bmp &second_image,
+                       float weight) {
+    TRACE_SCOPE("merge");
+    return merge_simd(mode, FixedWeight::from(weight, options.rounding), first_image, second_image, &context);
+}
+
+std::filesystem::path
+ImageMerger::merge_files(Algorithm algorithm, BlendMode mode, const std::filesystem::path &first,
+                         const std::filesystem::path &second, const std::filesystem::path &out_path, float weight) {
+    if (options.region) {
+        return merge_images_roi(mode, first, second, out_path, weight, *options.region, options.preview, algorithm);
+    }
     try {
-        Bmp first_image{first};
-        Bmp second_image{second};
+        if (options.async_load) {
+            MergeContext context{};
+            AsyncLoader loader{context, options.async_backend};
+            auto const [first_image, second_image] = [&] {
+                TRACE_SCOPE("load");
+                return loader.load_pair(first, second, options.resample == Resample::none).get();
+            }();
+            return merge_to_file(mode, first_image, second_image, weight, algorithm, out_path);
+        }
+        Bmp first_image{first, options.load_mode};
+        Bmp second_image{second, options.load_mode};
 
-        if (first_image.getHeader().height != second_image.getHeader().height ||
-            first_image.getHeader().width != second_image.getHeader().width) {
-            std::cout << first_image.getHeader().height << "  " << second_image.getHeader().height << "   "
-                      << first_image.getHeader().width << "  " << second_image.getHeader().width;
-            throw std::runtime_error("Images aren't matching.\n");
-        } else {
-            auto out_header = first_image.getHeader();
-            auto const &first_vector = first_image.getPixelData();
-            auto const &second_vector = second_image.getPixelData();
-            size_t const height = first_image.getHeader().height;
-            size_t const width = first_vector.size() / height;
+        return merge_to_file(mode, first_image, second_image, weight, algorithm, out_path);
+    } catch (std::exception &e) { *options.errors << e.what(); }
+    return {};
+}
 
-            auto first_array = get_2d_pixels(first_vector, height);
-            auto second_array = get_2d_pixels(second_vector, height);
+std::filesystem::path
+ImageMerger::merge_images_roi(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                              const std::filesystem::path &out_path, float weight, const Bmp::Region &region,
+                              std::size_t preview, Algorithm algorithm) {
+    try {
+        if (preview != 1 && preview != 2 && preview != 4 && preview != 8) {
+            throw std::runtime_error("The preview factor must be 1, 2, 4 or 8.\n");
+        }
+        Bmp const first_image{first, region};
+        Bmp const second_image{second, region};
+        Bmp out = merge(mode, first_image, second_image, weight, algorithm);
+
+        if (preview > 1) {
+            TRACE_SCOPE("preview");
+            auto const &header = out.getHeader();
+            auto const pixels = out.getPixels();
+            auto const width = static_cast<int32_t>((region.width + preview - 1) / preview);
+            auto const height = static_cast<int32_t>((region.height + preview - 1) / preview);
+            auto const preview_header = Bmp::make_header(width, header.height < 0 ? -height : height,
+                                                         header.bits_per_pixel);
+            std::size_t const row_size = preview_header.image_size / height;
+            auto preview_pixels = std::make_shared<AlignedBuffer>(preview_header.image_size);
+            auto const bytes = preview_pixels->getBytes();
+            // both images keep the same row order, so no row is flipped
+            Resampler const resampler{Resample::box, region.width, region.height, static_cast<std::size_t>(width),
+                                      static_cast<std::size_t>(height), header.bits_per_pixel / 8u};
+#pragma omp parallel num_threads(engine.threads()) default(shared)
+            {
+                Resampler::Scratch scratch{};
+#pragma omp for schedule(static)
+                for (int32_t y = 0; y < height; ++y) {
+                    auto const row = bytes.subspan(y * row_size, row_size);
+                    std::fill(row.begin(), row.end(), std::byte{0});
+                    resampler.row(pixels, pixels.size() / region.height, y, false, scratch, row);
+                }
+            }
+            out = Bmp{preview_header, std::move(preview_pixels)};
+        }
 
-            std::vector<std::vector<std::byte>> out_array(height, std::vector<std::byte>(width));
+        auto const path = out.write_image(out_path, options.write_mode);
+        if (path.empty() || Bmp::is_standard_output(path)) { return path; }
+        return absolute(path);
+    } catch (std::exception &e) { *options.errors << e.what(); }
+    return {};
+}
 
+std::filesystem::path
+ImageMerger::merge_to_file(BlendMode mode, const Bmp &first_image, const Bmp &second_image, float weight,
+                           Algorithm algorithm, const std::filesystem::path &out_path) {
+    bool const standard_output = Bmp::is_standard_output(out_path);
+    std::optional<uint64_t> key{};
+    if (results && !standard_output) {
+        TRACE_SCOPE("result cache fetch");
+        key = result_key(mode, first_image, second_image, weight);
+        if (results->fetch(*key, out_path)) { return absolute(out_path); }
+    }
+    // the mapped output is truncated before the blend reads the inputs, so an output that is also an input is merged
+    // into memory first
+    if (options.write_mode == Bmp::WriteMode::map && algorithm == Algorithm::simd && !standard_output &&
+        !is_input(out_path, {first_image.getSource(), second_image.getSource(),
+                             mask ? mask->getSource() : std::filesystem::path{}})) {
+        try {
+            TRACE_SCOPE("merge");
+            auto const &header = first_image.getHeader();
+            if (out_path.extension() != ".bmp") {
+                throw std::runtime_error("File " + out_path.string() + " is not a .bmp file.\n");
+            }
+            Bmp::detach_output(out_path);
+            OutputFile out{out_path, header.offset + first_image.getPixels().size()};
+            Bmp::write_header(out.getBytes(), header);
+            blend_into(mode, FixedWeight::from(weight, options.rounding), first_image, second_image,
+                       out.getBytes().subspan(header.offset));
+        } catch (std::exception &e) {
+            // the file was created before the images were checked, a failed merge leaves nothing behind
+            std::error_code error{};
+            if (out_path.extension() == ".bmp") { std::filesystem::remove(out_path, error); }
+            *options.errors << e.what();
+            return {};
+        }
+        if (key) {
+            TRACE_SCOPE("result cache store");
+            results->store(*key, out_path);
+        }
+        return absolute(out_path);
+    }
+    Bmp out = merge(mode, first_image, second_image, weight, algorithm);
+    auto const path = out.write_image(out_path, options.write_mode);
+    if (path.empty()) { return {}; }
+    if (standard_output) { return path; }
+    if (key) {
+        TRACE_SCOPE("result cache store");
+        results->store(*key, path);
+    }
+    return absolute(path);
+}
 
+std::optional<uint64_t>
+ImageMerger::result_key(BlendMode mode, const Bmp &first_image, const Bmp &second_image, float weight) {
+    if (!results) { return std::nullopt; }
+    auto const &first_header = first_image.getHeader();
+    auto const &second_header = second_image.getHeader();
+    // a resampled merge also depends on the filter and on the size of the second image
+    uint64_t variant = 0;
+    if (first_header.width != second_header.width || first_header.height != second_header.height) {
+        std::array<uint64_t, 3> const fields{static_cast<uint64_t>(options.resample),
+                                             static_cast<uint64_t>(static_cast<uint32_t>(second_header.width)),
+                                             static_cast<uint64_t>(static_cast<uint32_t>(second_header.height))};
+        variant = xxh64(std::as_bytes(std::span(fields)));
+    }
+    if (mask) {
+        std::array<uint64_t, 3> const fields{variant, hash_blocks(mask->getPixels(), engine.threads()),
+                                             xxh64(std::as_bytes(std::span(&mask->getHeader(), 1)))};
+        variant = xxh64(std::as_bytes(std::span(fields)));
+    }
+    return ResultCache::key(mode, FixedWeight::from(weight, options.rounding), first_image, second_image,
+                            engine.threads(), variant);
+}
+
+ResultCache *ImageMerger::getResultCache() {
+    return results.get();
+}
+
+template<typename Op>
+Bmp ImageMerger::merge_base(Op op, const Bmp &first_image, const Bmp &second_image) {
+    if (first_image.getHeader().height != second_image.getHeader().height ||
+        first_image.getHeader().width != second_image.getHeader().width) {
+        std::cout << first_image.getHeader().height << "  " << second_image.getHeader().height << "   "
+                  << first_image.getHeader().width << "  " << second_image.getHeader().width;
+        throw std::runtime_error("Images aren't matching.\n");
+    } else {
+        auto out_header = first_image.getHeader();
+        auto const first_vector = first_image.getPixels();
+        auto const second_vector = second_image.getPixels();
+        auto first_array = get_2d_pixels(first_vector, out_header);
+        auto second_array = get_2d_pixels(second_vector, second_image.getHeader());
+        size_t const height = first_array.size();
+        size_t const width = row_stride(out_header);
+
+        std::vector<std::vector<std::byte>> out_array(height, std::vector<std::byte>(width));
+
+
+        {
+            TRACE_SCOPE("blend");
             for (size_t j = 0; j < width; ++j) {
                 for (size_t i = 0; i < height; ++i) {
-                    std::byte pixel{};
-                    if (merger) {
-                        pixel = std::byte(weight * std::to_integer<int>(first_array[i][j]) +
-                                          (1 - weight) * std::to_integer<int>(second_array[i][j]));
-
-                    } else {
-                        pixel = std::byte(std::max(std::to_integer<int>(first_array[i][j]),
-                                                   std::to_integer<int>(second_array[i][j])));
-                    }
-                    out_array[i][j] = pixel;
+                    out_array[i][j] = op(first_array[i][j], second_array[i][j]);
                 }
             }
+        }
 
-            auto out_vec = get_vec_pixels(out_array);
+        auto out_vec = get_vec_pixels(out_array);
 
 
-            Bmp out{out_header, out_vec};
-            return absolute(out.write_image(out_path));
-        }
-    } catch (std::exception &e) { std::cerr << e.what(); }
-    return {};
+        return Bmp{out_header, std::move(out_vec)};
+    }
 }
 
+template<typename Op>
+Bmp ImageMerger::merge_cache(Op op, const Bmp &first_image, const Bmp &second_image) {
+    if (first_image.getHeader().height != second_image.getHeader().height ||
+        first_image.getHeader().width != second_image.getHeader().width) {
+        throw std::runtime_error("Images aren't matching.\n");
+    } else {
+        // cast vector to span
+        auto const first_pixel_data = first_image.getPixels();
+        auto const second_pixel_data = second_image.getPixels();
 
-std::filesystem::path
-ImageMerger::merge_images_cache(int merger, const std::filesystem::path &first, const std::filesystem::path &second,
-                                const std::filesystem::path &out_path, float weight) {
-    try {
-        Bmp first_image{first};
-        Bmp second_image{second};
+        auto out_header = first_image.getHeader();
+        std::vector<std::byte> out_pixels(first_pixel_data.size());
 
-        if (first_image.getHeader().height != second_image.getHeader().height ||
-            first_image.getHeader().width != second_image.getHeader().width) {
-            throw std::runtime_error("Images aren't matching.\n");
-        } else {
-            // cast vector to span
-            auto const &first_pixel_data = std::span<const std::byte>(first_image.getPixelData());
-            auto const &second_pixel_data = std::span<const std::byte>(second_image.getPixelData());
+        TRACE_SCOPE("blend");
+        for (size_t i = 0; i < first_pixel_data.size(); ++i) {
+            //change of access at() -> []
 
-            auto out_header = first_image.getHeader();
-            std::vector<std::byte> out_pixels(first_pixel_data.size());
+            out_pixels[i] = op(first_pixel_data[i], second_pixel_data[i]);
+        }
 
-            for (size_t i = 0; i < first_pixel_data.size(); ++i) {
-                //change of access at() -> []
+        return Bmp{out_header, std::move(out_pixels)};
+    }
+}
 
-                std::byte pixel{};
-                if (merger) {
-                    pixel = std::byte(weight * std::to_integer<int>(first_pixel_data[i]) +
-                                      (1 - weight) * std::to_integer<int>(second_pixel_data[i]));
-                } else {
-                    pixel = std::byte(std::max(std::to_integer<int>(first_pixel_data[i]),
-                                               std::to_integer<int>(second_pixel_data[i])));
+template<typename Op>
+Bmp ImageMerger::merge_openmp(Op op, const Bmp &first_image, const Bmp &second_image) {
+    if (first_image.getHeader().height != second_image.getHeader().height ||
+        first_image.getHeader().width != second_image.getHeader().width) {
+        throw std::runtime_error("Images aren't matching.\n");
+    } else {
+        auto out_header = first_image.getHeader();
+        auto const &first_pixel_data = get_2d_pixels(first_image.getPixels(), out_header);
+        auto const &second_pixel_data = get_2d_pixels(second_image.getPixels(), second_image.getHeader());
+        size_t const height = first_pixel_data.size();
+        size_t const width = row_stride(out_header);
+        std::vector<std::vector<std::byte>> out_array(height, std::vector<std::byte>(width));
+
+
+        {
+            TRACE_SCOPE("blend");
+            // one flat team over the rows, a nested region per row would spawn threads * threads workers
+#pragma omp parallel for num_threads(engine.threads()) schedule(static)
+            for (size_t i = 0; i < height; ++i) {
+                for (size_t j = 0; j < width; ++j) {
+                    out_array[i][j] = op(first_pixel_data[i][j], second_pixel_data[i][j]);
                 }
-                out_pixels[i] = pixel;
             }
+        }
 
-            Bmp out{out_header, out_pixels};
-            return absolute(out.write_image(out_path));
+        auto out_vec = get_vec_pixels(out_array);
 
+        return Bmp{out_header, std::move(out_vec)};
+    }
+}
+
+template<typename Op>
+Bmp ImageMerger::merge_optimized(Op op, const Bmp &first_image, const Bmp &second_image) {
+    if (first_image.getHeader().height != second_image.getHeader().height ||
+        first_image.getHeader().width != second_image.getHeader().width) {
+        throw std::runtime_error("Images aren't matching.\n");
+    } else {
+        auto const first_pixel_data = first_image.getPixels();
+        auto const second_pixel_data = second_image.getPixels();
+
+        auto out_header = first_image.getHeader();
+        std::vector<std::byte> out_pixels(first_pixel_data.size());
+
+        TRACE_SCOPE("blend");
+#pragma omp parallel for num_threads(engine.threads())
+
+        for (size_t i = 0; i < first_pixel_data.size(); ++i) {
+            //change of access at() -> []
+            out_pixels[i] = op(first_pixel_data[i], second_pixel_data[i]);
         }
-    } catch (std::exception &e) { std::cerr << e.what(); }
-    return {};
+
+        return Bmp{out_header, std::move(out_pixels)};
+    }
+}
+
+template<typename Function>
+void ImageMerger::for_rows(std::size_t height, std::size_t stride, bool top_down, Function &&function) {
+    engine.for_chunks(height * stride, [&](std::size_t begin, std::size_t end) {
+        TRACE_SCOPE("blend chunk");
+        std::size_t const first_row = (begin + stride - 1) / stride;
+        std::size_t const last_row = (end + stride - 1) / stride;
+        if (first_row >= last_row) { return; }
+        if (top_down) {
+            function(first_row, last_row);
+        } else {
+            function(height - last_row, height - first_row);
+        }
+    });
+}
+
+void ImageMerger::blend_into(BlendMode mode, FixedWeight const &blend, const Bmp &first_image,
+                             const Bmp &second_image, std::span<std::byte> out) {
+    if (mask) {
+        blend_masked(mode, blend, first_image, second_image, out);
+        return;
+    }
+    if (first_image.getHeader().height != second_image.getHeader().height ||
+        first_image.getHeader().width != second_image.getHeader().width) {
+        if (options.resample == Resample::none) {
+            throw std::runtime_error("Images aren't matching.\n");
+        }
+        blend_resampled(mode, blend, first_image, second_image, out);
+        return;
+    }
+    auto const &header = first_image.getHeader();
+    auto const first_pixel_data = first_image.getPixels();
+    auto const second_pixel_data = second_image.getPixels();
+    auto const format = pixel_format(header);
+    if (format != pixel_format(second_image.getHeader())) {
+        throw std::runtime_error("Images aren't matching.\n");
+    }
+    if (!format) {
+        // other bit depths are blended byte by byte, row padding included
+        if (second_pixel_data.size() < first_pixel_data.size()) {
+            throw std::runtime_error("Images aren't matching.\n");
+        }
+        TRACE_SCOPE("blend");
+        blend_chunks(mode, first_pixel_data, second_pixel_data, out, blend);
+        return;
+    }
+
+    TRACE_SCOPE("blend");
+    with_pixel_format(*format, [&](auto format) {
+        constexpr PixelFormat Format = decltype(format)::value;
+        ImageView<Format> const first_view{header, first_pixel_data};
+        ImageView<Format> const second_view{second_image.getHeader(), second_pixel_data};
+        ImageView<Format, std::byte> const out_view{header, out};
+        std::size_t const height = out_view.getHeight();
+        std::size_t const stride = out_view.getStride();
+        for_rows(height, stride, out_view.isTopDown(), [&](std::size_t begin, std::size_t end) {
+            simd::blend(mode, blend, first_view, second_view, out_view, begin, end);
+        });
+        // bytes after the last row, if any, are kept from the first image
+        std::copy(first_pixel_data.begin() + static_cast<std::ptrdiff_t>(height * stride), first_pixel_data.end(),
+                  out.begin() + static_cast<std::ptrdiff_t>(height * stride));
+    });
+}
+
+void ImageMerger::blend_masked(BlendMode mode, FixedWeight const &blend, const Bmp &first_image,
+                               const Bmp &second_image, std::span<std::byte> out) {
+    if (mode != BlendMode::average) {
+        throw std::runtime_error("A mask can only weight the average mode.\n");
+    }
+    auto const &header = first_image.getHeader();
+    auto const format = pixel_format(header);
+    if (header.height != second_image.getHeader().height || header.width != second_image.getHeader().width ||
+        !format || format != pixel_format(second_image.getHeader())) {
+        throw std::runtime_error("Images aren't matching.\n");
+    }
+    MaskView const mask_view{mask->getHeader(), mask->getPixels()};
+    if (mask_view.getWidth() != static_cast<std::size_t>(std::abs(header.width)) ||
+        mask_view.getHeight() != static_cast<std::size_t>(std::abs(header.height))) {
+        throw std::runtime_error("The mask must have the size of the images.\n");
+    }
+
+    TRACE_SCOPE("blend");
+    auto const first_pixel_data = first_image.getPixels();
+    with_pixel_format(*format, [&](auto format) {
+        constexpr PixelFormat Format = decltype(format)::value;
+        ImageView<Format> const first_view{header, first_pixel_data};
+        ImageView<Format> const second_view{second_image.getHeader(), second_image.getPixels()};
+        ImageView<Format, std::byte> const out_view{header, out};
+        std::size_t const height = out_view.getHeight();
+        std::size_t const stride = out_view.getStride();
+        for_rows(height, stride, out_view.isTopDown(), [&](std::size_t begin, std::size_t end) {
+            simd::blend_masked(blend, first_view, second_view, mask_view, out_view, begin, end);
+        });
+        std::copy(first_pixel_data.begin() + static_cast<std::ptrdiff_t>(height * stride), first_pixel_data.end(),
+                  out.begin() + static_cast<std::ptrdiff_t>(height * stride));
+    });
+}
+
+void ImageMerger::reject_mask() const {
+    if (mask) {
+        throw std::runtime_error("A mask can only be used by the two-image merges of the base, cache, openmp, optimized "
+                                 "and simd algorithm versions.\n");
+    }
 }
 
+void ImageMerger::reject_region() const {
+    if (options.region || options.preview != 1) {
+        throw std::runtime_error("A region or preview can only be used by the two-image merges of the base, cache, "
+                                 "openmp, optimized and simd algorithm versions.\n");
+    }
+}
+
+void ImageMerger::blend_resampled(BlendMode mode, FixedWeight const &blend, const Bmp &first_image,
+                                  const Bmp &second_image, std::span<std::byte> out) {
+    auto const &first_header = first_image.getHeader();
+    auto const &second_header = second_image.getHeader();
+    auto const first_pixels = first_image.getPixels();
+    auto const second_pixels = second_image.getPixels();
+    std::size_t const bytes_per_pixel = first_header.bits_per_pixel / 8u;
+    std::size_t const height = std::abs(first_header.height);
+    std::size_t const source_height = std::abs(second_header.height);
+    if (first_header.bits_per_pixel != second_header.bits_per_pixel || bytes_per_pixel == 0 || height == 0 ||
+        source_height == 0) {
+        throw std::runtime_error("Images aren't matching.\n");
+    }
+    std::size_t const row_size = first_pixels.size() / height;
+    std::size_t const source_row_size = second_pixels.size() / source_height;
+    std::size_t const width = std::abs(first_header.width);
+    std::size_t const source_width = std::abs(second_header.width);
+    if (width * bytes_per_pixel > row_size || source_width * bytes_per_pixel > source_row_size) {
+        throw std::runtime_error("Images aren't matching.\n");
+    }
+    Resampler const resampler{options.resample, source_width, source_height, width, height, bytes_per_pixel};
+    // a negative height stores the rows top-down, the second image is flipped if the two disagree
+    bool const flip = (first_header.height < 0) != (second_header.height < 0);
+
+    TRACE_SCOPE("resample and blend");
+#pragma omp parallel num_threads(engine.threads()) default(shared)
+    {
+        Resampler::Scratch scratch{};
+        // the padding of a row blends with zeros
+        std::vector<std::byte> resampled(row_size, std::byte{0});
+#pragma omp for schedule(static)
+        for (std::size_t y = 0; y < height; ++y) {
+            resampler.row(second_pixels, source_row_size, y, flip, scratch, resampled);
+            simd::blend(mode, blend, first_pixels.subspan(y * row_size, row_size), resampled,
+                        out.subspan(y * row_size, row_size));
+        }
+    }
+    // bytes after the last row, if any, are kept from the first image
+    std::copy(first_pixels.begin() + static_cast<std::ptrdiff_t>(height * row_size), first_pixels.end(),
+              out.begin() + static_cast<std::ptrdiff_t>(height * row_size));
+}
+
+Bmp ImageMerger::merge_simd(BlendMode mode, FixedWeight const &blend, const Bmp &first_image, const Bmp &second_image,
+                            MergeContext *context) {
+    auto out_header = first_image.getHeader();
+    std::size_t const size = first_image.getPixels().size();
+    // a new buffer is left uninitialised, so every page is first touched by the thread that blends into it,
+    // and a pooled one is reused with its pages already faulted in on the same nodes
+    auto out_pixels = context ? context->acquire(size) : std::make_shared<AlignedBuffer>(size);
+    blend_into(mode, blend, first_image, second_image, out_pixels->getBytes());
+
+    return Bmp{out_header, std::move(out_pixels)};
+}
 
 std::filesystem::path
-ImageMerger::merge_images_openmp(int merger, const std::filesystem::path &first, const std::filesystem::path &second,
-                                 const std::filesystem::path &out_path, float weight) {
+ImageMerger::merge_images_streaming(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                                    const std::filesystem::path &out_path, float weight) {
+    // an output that is one of the inputs is written next to it and renamed over it once every band was read
+    std::filesystem::path temporary{};
     try {
-        Bmp first_image{first};
-        Bmp second_image{second};
+        reject_mask();
+        reject_region();
+        std::ifstream first_in{first, std::ios::binary};
+        std::ifstream second_in{second, std::ios::binary};
+        if (!first_in || !second_in) {
+            throw std::runtime_error("Input images failed to open.\n");
+        }
+        auto const first_header = Bmp::read_header(first_in);
+        auto const second_header = Bmp::read_header(second_in);
 
-        if (first_image.getHeader().height != second_image.getHeader().height ||
-            first_image.getHeader().width != second_image.getHeader().width) {
+        // the bands are blended byte by byte, so a 24-bit and a 32-bit image of the same size must not pass
+        if (first_header.height != second_header.height || first_header.width != second_header.width ||
+            first_header.bits_per_pixel != second_header.bits_per_pixel) {
             throw std::runtime_error("Images aren't matching.\n");
         } else {
-            auto out_header = first_image.getHeader();
-            size_t const height = out_header.height;
+            std::size_t const pixel_size = std::filesystem::file_size(first) - first_header.offset;
+            if (std::filesystem::file_size(second) - second_header.offset < pixel_size) {
+                throw std::runtime_error("Images aren't matching.\n");
+            }
+            // a negative height stores the rows top-down, which the bands do not care about
+            std::size_t const height = std::abs(first_header.height);
+            if (height == 0) {
+                throw std::runtime_error("File " + first.string() + " has no pixel rows.\n");
+            }
+            std::size_t const row_size = pixel_size / height;
+            std::size_t const band_size = std::max<std::size_t>(options.band_rows, 1) * row_size;
+            if (band_size == 0) {
+                throw std::runtime_error("File " + first.string() + " ended before its first pixel row.\n");
+            }
 
-            auto const &first_pixel_data = get_2d_pixels(first_image.getPixelData(), height);
-            auto const &second_pixel_data = get_2d_pixels(second_image.getPixelData(), height);
-            size_t const width = first_pixel_data[0].size();
-            std::vector<std::vector<std::byte>> out_array(height, std::vector<std::byte>(width));
+            std::ofstream file{};
+            if (!Bmp::is_standard_output(out_path)) {
+                if (is_input(out_path, {first, second})) {
+                    temporary = out_path;
+                    temporary += ".tmp." + std::to_string(getpid());
+                    file.open(temporary, std::ios::binary);
+                } else {
+                    Bmp::detach_output(out_path);
+                    file.open(out_path, std::ios::binary);
+                }
+                if (!file.is_open()) {
+                    throw std::runtime_error("File " + out_path.string() + " failed to open.\n");
+                }
+            }
+            std::ostream &out = file.is_open() ? file : std::cout;
+            Bmp::write_header(out, first_header);
+
+            struct Band {
+                std::vector<std::byte> first;
+                std::vector<std::byte> second;
+                std::size_t size;
+            };
+            std::array<Band, 2> bands{Band{std::vector<std::byte>(band_size), std::vector<std::byte>(band_size), 0},
+                                      Band{std::vector<std::byte>(band_size), std::vector<std::byte>(band_size), 0}};
+            std::vector<std::byte> out_band(band_size);
+            auto const blend = FixedWeight::from(weight, options.rounding);
+
+            auto read_band = [&](Band &band, std::size_t size) {
+                TRACE_SCOPE("read band");
+                first_in.read(reinterpret_cast<char *>(band.first.data()), static_cast<std::streamsize>(size));
+                second_in.read(reinterpret_cast<char *>(band.second.data()), static_cast<std::streamsize>(size));
+                if (!first_in || !second_in) {
+                    throw std::runtime_error("Input images ended before all of their rows were read.\n");
+                }
+                band.size = size;
+            };
+
+            // double buffering, band k + 1 is read in the background while band k is merged and written
+            std::size_t offset = 0;
+            std::size_t current = 0;
+            auto pending = std::async(std::launch::async, read_band, std::ref(bands[0]), std::min(band_size, pixel_size));
+            while (offset < pixel_size) {
+                pending.get();
+                auto const &band = bands[current];
+                offset += band.size;
+                if (offset < pixel_size) {
+                    pending = std::async(std::launch::async, read_band, std::ref(bands[1 - current]),
+                                         std::min(band_size, pixel_size - offset));
+                }
+
+                auto const out_span = std::span<std::byte>(out_band).first(band.size);
+                {
+                    TRACE_SCOPE("blend");
+                    blend_chunks(mode, std::span<const std::byte>(band.first).first(band.size),
+                                 std::span<const std::byte>(band.second).first(band.size), out_span, blend);
+                }
+                TRACE_SCOPE("write band");
+                out.write(reinterpret_cast<const char *>(out_span.data()), static_cast<std::streamsize>(out_span.size()));
+                current = 1 - current;
+            }
+            if (!out.flush()) {
+                throw std::runtime_error("File " + out_path.string() + " failed to write.\n");
+            }
+            if (!temporary.empty()) {
+                file.close();
+                std::filesystem::rename(temporary, out_path);
+            }
+            return Bmp::is_standard_output(out_path) ? out_path : absolute(out_path);
+        }
+    } catch (std::exception &e) {
+        *options.errors << e.what();
+        std::error_code error{};
+        if (!temporary.empty()) { std::filesystem::remove(temporary, error); }
+    }
+    return {};
+}
 
+std::filesystem::path
+ImageMerger::merge_images_incremental(BlendMode mode, const std::filesystem::path &first,
+                                      const std::filesystem::path &second, const std::filesystem::path &out_path,
+                                      float weight) {
+    try {
+        reject_mask();
+        reject_region();
+        if (Bmp::is_standard_output(out_path)) {
+            throw std::runtime_error("The standard output can not be patched, the incremental merge needs a file.\n");
+        }
+        Bmp first_image{first, options.load_mode};
+        Bmp second_image{second, options.load_mode};
+        auto const &header = first_image.getHeader();
+        auto const first_pixels = first_image.getPixels();
+        auto const second_pixels = second_image.getPixels();
+        if (header.height != second_image.getHeader().height || header.width != second_image.getHeader().width ||
+            second_pixels.size() < first_pixels.size()) {
+            throw std::runtime_error("Images aren't matching.\n");
+        }
+        auto blend = FixedWeight::from(weight, options.rounding);
+        if (!uses_weight(mode)) { blend = {}; }
 
-#pragma omp parallel default(shared)
+        std::size_t const height = std::abs(header.height);
+        if (height == 0) {
+            throw std::runtime_error("File " + first.string() + " has no pixel rows.\n");
+        }
+        // tiles are numbered in the order the rows are stored, which is all the checksums and patches rely on
+        TileGrid const grid{options.tile_size, header.bits_per_pixel / 8u, first_pixels.size(), height};
+        std::size_t const row_pixels = std::abs(header.width) * grid.bytes_per_pixel;
+        TileIndex index{};
+        index.settings = {grid.tile, grid.columns(), grid.rows(), static_cast<uint64_t>(mode),
+                          static_cast<uint64_t>(blend.first) << 32 | static_cast<uint64_t>(blend.second) << 16 | blend.bias,
+                          xxh64(std::as_bytes(std::span(&header, 1)), first_pixels.size())};
+        {
+            TRACE_SCOPE("checksum tiles");
+            index.first = tile_checksums(first_pixels, grid, engine.threads());
+            index.second = tile_checksums(second_pixels.first(first_pixels.size()), grid, engine.threads());
+        }
+
+        auto sidecar = out_path;
+        sidecar += ".tiles";
+        auto const previous = TileIndex::read(sidecar);
+        struct stat status{};
+        // an output linked into a result cache, or written by anything else since, is never patched
+        bool const patchable = previous && previous->settings == index.settings && stat(out_path.c_str(), &status) == 0 &&
+                               S_ISREG(status.st_mode) && status.st_nlink == 1 &&
+                               static_cast<uint64_t>(status.st_size) == previous->out_size &&
+                               status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec == previous->out_modified;
+
+        if (!patchable) {
+            // written before the output, so a failure in between leaves no sidecar that matches it
+            std::filesystem::remove(sidecar);
+            Bmp out = merge(mode, first_image, second_image, weight, Algorithm::simd);
+            if (out.write_image(out_path).empty()) { return {}; }
+        } else {
+            int const fd = open(out_path.c_str(), O_WRONLY | O_CLOEXEC);
+            if (fd < 0) {
+                throw std::runtime_error("File " + out_path.string() + " failed to open.\n");
+            }
+            TRACE_SCOPE("patch tiles");
+            bool failed = false;
+            std::size_t const columns = grid.columns();
+#pragma omp parallel num_threads(engine.threads()) default(shared)
             {
-#pragma omp for
-                for (size_t i = 0; i < height; ++i) {
-#pragma omp parallel shared(i, height)
-                    {
-#pragma omp for
-                        for (size_t j = 0; j < width; ++j) {
-                            std::byte pixel{};
-                            if (merger) {
-                                pixel = std::byte(weight * std::to_integer<int>(first_pixel_data[i][j]) +
-                                                  (1 - weight) * std::to_integer<int>(second_pixel_data[i][j]));
-                            } else {
-                                pixel = std::byte(std::max(std::to_integer<int>(first_pixel_data[i][j]),
-                                                           std::to_integer<int>(second_pixel_data[i][j])));
+                std::vector<std::byte> segment(grid.row_size + grid.size % std::max<std::size_t>(grid.height, 1));
+#pragma omp for schedule(dynamic)
+                for (std::size_t row = 0; row < grid.rows(); ++row) {
+                    // adjacent changed tiles of a tile row are blended and written as one range per pixel row
+                    for (std::size_t begin = 0; begin < columns;) {
+                        auto const changed = [&](std::size_t column) {
+                            std::size_t const tile = row * columns + column;
+                            return index.first[tile] != previous->first[tile] ||
+                                   index.second[tile] != previous->second[tile];
+                        };
+                        if (!changed(begin)) {
+                            ++begin;
+                            continue;
+                        }
+                        std::size_t end = begin + 1;
+                        while (end < columns && changed(end)) { ++end; }
+                        for (std::size_t y = row * grid.tile; y < std::min((row + 1) * grid.tile, grid.height); ++y) {
+                            auto const [offset, size] = grid.segment(y, begin, end);
+                            auto const out_span = std::span<std::byte>(segment).first(size);
+                            simd::blend(mode, blend, first_pixels.subspan(offset, size),
+                                        second_pixels.subspan(offset, size), out_span);
+                            if (end == columns && row_pixels < grid.row_size) {
+                                // a full merge leaves the row padding zeroed, a patched row has to match it
+                                std::size_t const padding = std::max(y * grid.row_size + row_pixels, offset) - offset;
+                                std::fill(out_span.begin() + padding,
+                                          out_span.begin() + ((y + 1) * grid.row_size - offset), std::byte{0});
+                            }
+                            auto const position = static_cast<off_t>(header.offset + offset);
+                            if (pwrite(fd, out_span.data(), size, position) != static_cast<ssize_t>(size)) {
+#pragma omp atomic write
+                                failed = true;
                             }
-                            out_array[i][j] = pixel;
                         }
+                        begin = end;
                     }
                 }
-
             }
+            close(fd);
+            if (failed) {
+                throw std::runtime_error("File " + out_path.string() + " failed to write.\n");
+            }
+        }
 
-            auto out_vec = get_vec_pixels(out_array);
+        if (stat(out_path.c_str(), &status) != 0) {
+            throw std::runtime_error("File " + out_path.string() + " failed to write.\n");
+        }
+        index.out_size = static_cast<uint64_t>(status.st_size);
+        index.out_modified = status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+        index.write(sidecar);
+        return absolute(out_path);
+    } catch (std::exception &e) { *options.errors << e.what(); }
+    return {};
+}
 
-            Bmp out{out_header, out_vec};
-            return absolute(out.write_image(out_path));
+std::vector<std::filesystem::path>
+ImageMerger::merge_sequence(const Bmp &first_image, const Bmp &second_image, const std::filesystem::path &out_path,
+                            std::size_t frames, Ramp ramp) {
+    reject_mask();
+    reject_region();
+    auto const &header = first_image.getHeader();
+    auto const first_pixels = first_image.getPixels();
+    auto const second_pixels = second_image.getPixels();
+    if (header.height != second_image.getHeader().height || header.width != second_image.getHeader().width ||
+        header.bits_per_pixel != second_image.getHeader().bits_per_pixel || second_pixels.size() < first_pixels.size()) {
+        throw std::runtime_error("Images aren't matching.\n");
+    }
+
+    std::vector<FixedWeight> weights(frames);
+    std::vector<std::filesystem::path> ret(frames);
+    int const digits = std::max(3, static_cast<int>(std::to_string(frames > 0 ? frames - 1 : 0).size()));
+    for (std::size_t frame = 0; frame < frames; ++frame) {
+        weights[frame] = FixedWeight::from(ramp_weight(ramp, frame, frames), options.rounding);
+        auto name = std::to_string(frame);
+        name.insert(0, static_cast<std::size_t>(digits) - std::min<std::size_t>(name.size(), digits), '0');
+        ret[frame] = absolute(out_path.parent_path() / (out_path.stem().string() + "_" + name + out_path.extension().string()));
+    }
 
+    // both inputs of a block stay in L1 and L2 while it is blended into every frame of a group
+    constexpr std::size_t block = 16 << 10;
+    std::size_t const group = std::max<std::size_t>(options.frame_group, 1);
+    BufferPool pool{};
+    std::future<bool> pending{};
+    for (std::size_t begin = 0; begin < frames; begin += group) {
+        std::size_t const end = std::min(frames, begin + group);
+        std::vector<std::shared_ptr<AlignedBuffer>> outputs{};
+        for (std::size_t frame = begin; frame < end; ++frame) { outputs.push_back(pool.acquire(first_pixels.size())); }
+        {
+            TRACE_SCOPE("blend frames");
+            engine.for_chunks(first_pixels.size(), [&](std::size_t chunk_begin, std::size_t chunk_end) {
+                for (std::size_t offset = chunk_begin; offset < chunk_end; offset += block) {
+                    std::size_t const size = std::min(block, chunk_end - offset);
+                    for (std::size_t frame = begin; frame < end; ++frame) {
+                        simd::blend(BlendMode::average, weights[frame], first_pixels.subspan(offset, size),
+                                    second_pixels.subspan(offset, size),
+                                    outputs[frame - begin]->getBytes().subspan(offset, size));
+                    }
+                }
+            });
         }
-    } catch (std::exception &e) { std::cerr << e.what(); }
-    return {};
+        // the previous group is written while this one was blended, one group at most waits for the disk
+        if (pending.valid() && !pending.get()) {
+            throw std::runtime_error("Frames of " + out_path.string() + " failed to write.\n");
+        }
+        pending = std::async(std::launch::async, [&, begin, outputs = std::move(outputs)] {
+            TRACE_SCOPE("write frames");
+            bool written = true;
+            for (std::size_t i = 0; i < outputs.size(); ++i) {
+                written &= !Bmp{header, outputs[i]}.write_image(ret[begin + i], options.write_mode).empty();
+            }
+            return written;
+        });
+    }
+    if (pending.valid() && !pending.get()) {
+        throw std::runtime_error("Frames of " + out_path.string() + " failed to write.\n");
+    }
+    return ret;
 }
 
+std::vector<std::filesystem::path>
+ImageMerger::merge_images_sequence(const std::filesystem::path &first, const std::filesystem::path &second,
+                                   const std::filesystem::path &out_path, std::size_t frames, Ramp ramp) {
+    try {
+        Bmp first_image{first, options.load_mode};
+        Bmp second_image{second, options.load_mode};
+        return merge_sequence(first_image, second_image, out_path, frames, ramp);
+    } catch (std::exception &e) { *options.errors << e.what(); }
+    return {};
+}
 
 std::filesystem::path
-ImageMerger::merge_images_optimized(int merger, const std::filesystem::path &first, const std::filesystem::path &second,
-                                    const std::filesystem::path &out_path, float weight) {
+ImageMerger::merge_images_many(BlendMode mode, const std::vector<std::filesystem::path> &inputs,
+                               const std::filesystem::path &out_path, const std::vector<float> &weights) {
     try {
-        Bmp first_image{first};
-        Bmp second_image{second};
-
-        if (first_image.getHeader().height != second_image.getHeader().height ||
-            first_image.getHeader().width != second_image.getHeader().width) {
-            throw std::runtime_error("Images aren't matching.\n");
-        } else {
-            auto const &first_pixel_data = first_image.getPixelData();
-            auto const &second_pixel_data = second_image.getPixelData();
+        reject_mask();
+        reject_region();
+        if (inputs.empty()) {
+            throw std::runtime_error("At least one input image is required.\n");
+        }
+        if (!weights.empty() && weights.size() != inputs.size()) {
+            throw std::runtime_error("Every input image needs a weight.\n");
+        }
 
-            auto out_header = first_image.getHeader();
-            std::vector<std::byte> out_pixels(first_pixel_data.size());
+        std::vector<Bmp> images{};
+        images.reserve(inputs.size());
+        for (auto const &input: inputs) {
+            images.emplace_back(input, options.load_mode);
+        }
+        auto const &out_header = images.front().getHeader();
+        std::vector<std::span<const std::byte>> pixels{};
+        for (auto const &image: images) {
+            if (image.getHeader().height != out_header.height || image.getHeader().width != out_header.width ||
+                image.getHeader().bits_per_pixel != out_header.bits_per_pixel ||
+                image.getPixels().size() < images.front().getPixels().size()) {
+                throw std::runtime_error("Images aren't matching.\n");
+            }
+            pixels.push_back(image.getPixels());
+        }
 
-#pragma omp parallel for
+        // normalise the weights into 0.16 fixed point, the rounding error goes to the largest weight so they sum to 1.0
+        std::vector<uint32_t> fixed_weights(inputs.size(), 0);
+        if (uses_weight(mode)) {
+            std::vector<double> normalised(weights.begin(), weights.end());
+            if (normalised.empty()) { normalised.assign(inputs.size(), 1.0); }
+            double const total = std::accumulate(normalised.begin(), normalised.end(), 0.0);
+            if (total <= 0.0 || std::any_of(normalised.begin(), normalised.end(), [](double w) { return w < 0.0; })) {
+                throw std::runtime_error("Weights must not be negative and must not all be zero.\n");
+            }
+            for (std::size_t i = 0; i < normalised.size(); ++i) {
+                fixed_weights[i] = static_cast<uint32_t>(std::lround(normalised[i] / total * 65536.0));
+            }
+            auto const largest = std::max_element(fixed_weights.begin(), fixed_weights.end());
+            *largest += 65536 - std::accumulate(fixed_weights.begin(), fixed_weights.end(), 0u);
+        }
+        uint32_t const bias = options.rounding == Rounding::nearest ? 32768 : 0;
 
-            for (size_t i = 0; i < first_pixel_data.size(); ++i) {
-                //change of access at() -> []
-                std::byte pixel{};
-                if (merger) {
-                    pixel = std::byte(weight * std::to_integer<int>(first_pixel_data[i]) +
-                                      (1 - weight) * std::to_integer<int>(second_pixel_data[i]));
+        std::size_t const size = pixels.front().size();
+        // every input has the same row order as the output, so the rows are blended in the order they are stored
+        std::size_t const height = std::abs(out_header.height);
+        if (height == 0) {
+            throw std::runtime_error("File " + inputs.front().string() + " has no pixel rows.\n");
+        }
+        std::size_t const row_size = size / height;
+        std::vector<std::byte> out_pixels(size);
+
+        TRACE_SCOPE("blend");
+#pragma omp parallel num_threads(engine.threads()) default(shared)
+        {
+            // a row of 32-bit sums stays in cache while every input adds its row to it
+            std::vector<uint32_t> sums(uses_weight(mode) ? row_size : 0);
+#pragma omp for schedule(static)
+            for (std::size_t row = 0; row < height; ++row) {
+                std::size_t const begin = row * row_size;
+                std::size_t const end = row + 1 == height ? size : begin + row_size;
+                auto const out_row = std::span<std::byte>(out_pixels).subspan(begin, end - begin);
+                if (mode == BlendMode::average) {
+                    sums.resize(out_row.size());
+                    std::fill(sums.begin(), sums.end(), bias);
+                    for (std::size_t input = 0; input < pixels.size(); ++input) {
+                        auto const row_pixels = pixels[input].subspan(begin, end - begin);
+                        uint32_t const input_weight = fixed_weights[input];
+                        for (std::size_t i = 0; i < row_pixels.size(); ++i) {
+                            sums[i] += std::to_integer<uint32_t>(row_pixels[i]) * input_weight;
+                        }
+                    }
+                    for (std::size_t i = 0; i < out_row.size(); ++i) {
+                        out_row[i] = std::byte(sums[i] >> 16);
+                    }
+                } else if (mode == BlendMode::linear) {
+                    // the same sums over 12-bit linear light, which still fit into 32 bits
+                    sums.resize(out_row.size());
+                    std::fill(sums.begin(), sums.end(), bias);
+                    for (std::size_t input = 0; input < pixels.size(); ++input) {
+                        auto const row_pixels = pixels[input].subspan(begin, end - begin);
+                        uint32_t const input_weight = fixed_weights[input];
+                        for (std::size_t i = 0; i < row_pixels.size(); ++i) {
+                            sums[i] += srgb::decode[std::to_integer<uint32_t>(row_pixels[i])] * input_weight;
+                        }
+                    }
+                    for (std::size_t i = 0; i < out_row.size(); ++i) {
+                        out_row[i] = std::byte(srgb::encode[sums[i] >> 16]);
+                    }
                 } else {
-                    pixel = std::byte(std::max(std::to_integer<int>(first_pixel_data[i]),
-                                               std::to_integer<int>(second_pixel_data[i])));
+                    std::copy_n(pixels.front().begin() + begin, out_row.size(), out_row.begin());
+                    for (std::size_t input = 1; input < pixels.size(); ++input) {
+                        simd::blend(mode, FixedWeight{}, out_row, pixels[input].subspan(begin, end - begin), out_row);
+                    }
                 }
-                out_pixels[i] = pixel;
             }
-
-            Bmp out{out_header, out_pixels};
-            return absolute(out.write_image(out_path));
-
         }
-    } catch (std::exception &e) { std::cerr << e.what(); }
+
+        Bmp out{out_header, std::move(out_pixels)};
+        auto const path = out.write_image(out_path, options.write_mode);
+        return Bmp::is_standard_output(path) ? path : absolute(path);
+    } catch (std::exception &e) { *options.errors << e.what(); }
     return {};
 }
 
-std::vector<std::vector<std::byte>> ImageMerger::get_2d_pixels(const std::vector<std::byte> &pixels, int height) {
+void ImageMerger::blend_chunks(BlendMode mode, std::span<const std::byte> first, std::span<const std::byte> second,
+                               std::span<std::byte> out, FixedWeight const &blend) {
+    engine.for_chunks(first.size(), [&](std::size_t begin, std::size_t end) {
+        // one event per thread and chunk, so the counters show how evenly the threads did
+        TRACE_SCOPE("blend chunk");
+        simd::blend(mode, blend, first.subspan(begin, end - begin), second.subspan(begin, end - begin),
+                    out.subspan(begin, end - begin));
+    });
+}
+
+std::vector<std::vector<std::byte>> ImageMerger::get_2d_pixels(std::span<const std::byte> pixels,
+                                                                const Bmp::BmpHeader &header) {
+    TRACE_SCOPE("get_2d_pixels");
 
-    int const width = pixels.size() / height;
+    // the rows as they are stored, padding included, the width of a row comes from the header and not the buffer size
+    std::size_t const height = std::abs(header.height);
+    std::size_t const width = row_stride(header);
+    if (pixels.size() < height * width) {
+        throw std::runtime_error("Images aren't matching.\n");
+    }
     std::vector<std::vector<std::byte>> ret(height, std::vector<std::byte>(width));
-#pragma omp parallel for
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
+#pragma omp parallel for num_threads(engine.threads()) schedule(static)
+    for (std::size_t i = 0; i < height; ++i) {
+        for (std::size_t j = 0; j < width; ++j) {
             ret[i][j] = pixels[i * width + j];
         }
     }
@@ -209,20 +978,14 @@ std::vector<std::vector<std::byte>> ImageMerger::get_2d_pixels(const std::vector
 }
 
 std::vector<std::byte> ImageMerger::get_vec_pixels(const std::vector<std::vector<std::byte>> &pixels) {
+    TRACE_SCOPE("get_vec_pixels");
     std::size_t height = pixels.size();
-    std::size_t width = pixels[0].size();
+    std::size_t width = pixels.empty() ? 0 : pixels[0].size();
     std::vector<std::byte> ret(width * height);
-#pragma omp parallel default(shared)
-    {
-#pragma omp for
-        for (size_t i = 0; i < height; ++i) {
-#pragma omp parallel shared(i, height)
-            {
-#pragma omp for
-                for (size_t j = 0; j < width; ++j) {
-                    ret[i * width + j] = pixels[i][j];
-                }
-            }
+#pragma omp parallel for num_threads(engine.threads()) schedule(static)
+    for (size_t i = 0; i < height; ++i) {
+        for (size_t j = 0; j < width; ++j) {
+            ret[i * width + j] = pixels[i][j];
         }
     }
 
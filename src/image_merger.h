@@ -8,24 +8,152 @@
 #include <cstddef>
 #include <filesystem>
 #include <vector>
+#include <span>
 #include <fstream>
 #include "bmp.h"
+#include "image_view.h"
+#include "blend.h"
+#include "async_loader.h"
+#include "merge_context.h"
+#include "resample.h"
+#include "result_cache.h"
+#include "parallel.h"
 #include <omp.h>
 #include <functional>
+#include <iostream>
+#include <optional>
 
+/**
+ * The implementations of the two-image merge, from the deliberately cache-unfriendly base version to the SIMD one.
+ */
+enum class Algorithm { base, cache, openmp, optimized, simd };
+
+/**
+ * Settings shared by all merge functions of an ImageMerger.
+ */
+struct MergeOptions {
+    Rounding rounding{Rounding::truncate};
+    Bmp::LoadMode load_mode{Bmp::LoadMode::map};
+    // with map, merge_to_file has the SIMD kernels blend straight into the mapped output file
+    Bmp::WriteMode write_mode{Bmp::WriteMode::stream};
+    // how a second image of another size is fitted to the first one, images of different sizes are rejected with none
+    Resample resample{Resample::none};
+    // when set, merges read from files only merge this rectangle, shrunk by the preview factor (1, 2, 4 or 8)
+    std::optional<Bmp::Region> region{};
+    std::size_t preview{1};
+    // an 8-bit grayscale or 32-bit image whose pixels replace the weight of the average mode of two-image merges
+    std::filesystem::path mask{};
+    // when set, both inputs are read concurrently by an AsyncLoader instead of one after the other with load_mode
+    bool async_load{false};
+    AsyncBackend async_backend{AsyncBackend::io_uring};
+    // a directory for cached merge results, no results are cached when empty
+    std::filesystem::path result_cache{};
+    std::size_t result_cache_bytes{std::size_t{1} << 30};
+    std::size_t band_rows{256};
+    // the edge length in pixels of the tiles merge_images_incremental checksums and patches
+    std::size_t tile_size{64};
+    // the frames merge_sequence blends in one pass over the inputs, and at most how many wait to be written
+    std::size_t frame_group{8};
+    ParallelOptions parallel{};
+    // where the merges that return an empty path on failure print why, the server points it at the client's stream
+    std::ostream *errors{&std::cerr};
+};
 
 class ImageMerger {
 
-    std::vector<std::vector<std::byte>> get_2d_pixels(std::vector<std::byte> const &pixels, int height);
+    MergeOptions options{};
+    ParallelEngine engine;
+    std::shared_ptr<ResultCache> results{};
+    std::shared_ptr<const Bmp> mask{};
+
+    std::vector<std::vector<std::byte>> get_2d_pixels(std::span<const std::byte> pixels, Bmp::BmpHeader const &header);
 
     std::vector<std::byte> get_vec_pixels(std::vector<std::vector<std::byte>> const &pixels);
 
+/**
+ * Blends two pixel buffers with the SIMD kernels, split into page aligned chunks by the parallel engine.
+ */
+    void blend_chunks(BlendMode mode, std::span<const std::byte> first, std::span<const std::byte> second,
+                      std::span<std::byte> out, FixedWeight const &blend);
+
+/**
+ * Loads two images, merges them with the given algorithm and writes the result.
+ */
+    std::filesystem::path
+    merge_files(Algorithm algorithm, BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                const std::filesystem::path &out_path, float weight);
+
+/**
+ * The merge kernels, instantiated once per blend operation policy from blend_ops.
+ */
+    template<typename Op>
+    Bmp merge_base(Op op, const Bmp &first_image, const Bmp &second_image);
+
+    template<typename Op>
+    Bmp merge_cache(Op op, const Bmp &first_image, const Bmp &second_image);
+
+    template<typename Op>
+    Bmp merge_openmp(Op op, const Bmp &first_image, const Bmp &second_image);
+
+    template<typename Op>
+    Bmp merge_optimized(Op op, const Bmp &first_image, const Bmp &second_image);
+
+/**
+ * Checks that two images can be merged with the SIMD kernel and blends their pixels into out, which must be as large
+ * as the pixels of the first image. Throws std::runtime_error if the images aren't matching.
+ */
+    void blend_into(BlendMode mode, FixedWeight const &blend, const Bmp &first_image, const Bmp &second_image,
+                    std::span<std::byte> out);
+
+/**
+ * Calls a function for disjoint ranges of rows, counted from the top, that together cover an image. The stored rows
+ * are split into page aligned chunks by the parallel engine and a row goes to the chunk it starts in.
+ */
+    template<typename Function>
+    void for_rows(std::size_t height, std::size_t stride, bool top_down, Function &&function);
+
+/**
+ * Blends two images of the same size with the weights of the mask, split between threads like blend_into.
+ * Throws std::runtime_error if the mode is not average or the mask does not have the size of the images.
+ */
+    void blend_masked(BlendMode mode, FixedWeight const &blend, const Bmp &first_image, const Bmp &second_image,
+                      std::span<std::byte> out);
+
+/**
+ * Throws std::runtime_error if a mask is set, for the merges that do not support one.
+ */
+    void reject_mask() const;
+
+/**
+ * Throws std::runtime_error if a region or a preview factor is set, for the merges that do not support them.
+ */
+    void reject_region() const;
+
+/**
+ * Resamples the second image to the size of the first one row by row with MergeOptions::resample and blends every
+ * row as soon as it is resampled, split between OpenMP threads by rows.
+ */
+    void blend_resampled(BlendMode mode, FixedWeight const &blend, const Bmp &first_image, const Bmp &second_image,
+                         std::span<std::byte> out);
+
+/**
+ * The SIMD kernel, writing into a pooled buffer of the context if one is given and into a new buffer otherwise.
+ */
+    Bmp merge_simd(BlendMode mode, FixedWeight const &blend, const Bmp &first_image, const Bmp &second_image,
+                   MergeContext *context);
+
 public:
+    /**
+ * Constructs an image merger. The mask of the options, if any, is loaded once here and used by every merge.
+ *
+ * @param options The settings used by every merge.
+ */
+    explicit ImageMerger(MergeOptions options = {});
+
 /**
  * Merges two images into a single image using either weighted or non-weighted blending.
  *
- * @param merger    An integer indicating the type of blending. A value of 0 corresponds to non-weighted blending,
- *                      while a value of 1 corresponds to weighted blending.
+ * @param mode      The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
  * @param first     The path to the first image to merge.
  * @param second    The path to the second image to merge.
  * @param out_path  The path where the merged image will be written.
@@ -34,15 +162,14 @@ public:
  * @return             The absolute path to the merged image file.
  */
     std::filesystem::path
-    merge_images(int merger, const std::filesystem::path &first, const std::filesystem::path &second,
+    merge_images(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
                  const std::filesystem::path &out_path, float weight = 0.5f);
 
 /**
  * Merges two images into a single image using either weighted or non-weighted blending,
  * using span instead of vectors to store pixel data and iterating through a 1D array instead of a 2D matrix to improve cache performance.
  *
- * @param merger    An integer indicating the type of blending. A value of 0 corresponds to non-weighted blending,
- *                      while a value of 1 corresponds to weighted blending.
+ * @param mode      The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
  * @param first     The path to the first image to merge.
  * @param second    The path to the second image to merge.
  * @param out_path  The path where the merged image will be written.
@@ -51,15 +178,14 @@ public:
  * @return             The absolute path to the merged image file.
  */
     std::filesystem::path
-    merge_images_cache(int merger, const std::filesystem::path &first, const std::filesystem::path &second,
+    merge_images_cache(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
                        const std::filesystem::path &out_path, float weight = 0.5f);
 
 /**
  * Merges two images into a single image using either weighted or non-weighted blending,
  * using OpenMP for parallelization.
  *
- * @param merger    An integer indicating the type of blending. A value of 0 corresponds to non-weighted blending,
- *                      while a value of 1 corresponds to weighted blending.
+ * @param mode      The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
  * @param first     The path to the first image to merge.
  * @param second    The path to the second image to merge.
  * @param out_path  The path where the merged image will be written.
@@ -68,15 +194,14 @@ public:
  * @return             The absolute path to the merged image file.
  */
     std::filesystem::path
-    merge_images_openmp(int merger, const std::filesystem::path &first, const std::filesystem::path &second,
+    merge_images_openmp(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
                         const std::filesystem::path &out_path, float weight = 0.5f);
 
 /**
  * Merges two images into a single image using either weighted or non-weighted blending,
  * using OpenMP for parallelization and a 1D vector for cache optimization.
  *
- * @param merger    An integer indicating the type of blending. A value of 0 corresponds to non-weighted blending,
- *                      while a value of 1 corresponds to weighted blending.
+ * @param mode      The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
  * @param first     The path to the first image to merge.
  * @param second    The path to the second image to merge.
  * @param out_path  The path where the merged image will be written.
@@ -85,6 +210,194 @@ public:
  * @return             The absolute path to the merged image file.
  */
     std::filesystem::path
-    merge_images_optimized(int merger, const std::filesystem::path &first, const std::filesystem::path &second,
+    merge_images_optimized(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
                            const std::filesystem::path &out_path, float weight);
+
+/**
+ * Merges two images into a single image using either weighted or non-weighted blending,
+ * using hand-written SSE2, AVX2 or AVX-512BW kernels chosen at runtime and OpenMP for parallelization.
+ *
+ * @param mode      The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
+ * @param first     The path to the first image to merge.
+ * @param second    The path to the second image to merge.
+ * @param out_path  The path where the merged image will be written.
+ * @param weight    A float value that determines the blending ratio when weighted blending is used.
+ *
+ * @return             The absolute path to the merged image file.
+ */
+    std::filesystem::path
+    merge_images_simd(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                      const std::filesystem::path &out_path, float weight);
+
+/**
+ * Merges a rectangle of two images, reading only the rows of the rectangle from both files, and writes an image of the
+ * rectangle's size. The result cache is not used.
+ *
+ * @param mode       The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
+ * @param first      The path to the first image to merge.
+ * @param second     The path to the second image to merge.
+ * @param out_path   The path where the merged rectangle will be written.
+ * @param weight     A float value that determines the blending ratio when weighted blending is used.
+ * @param region     The rectangle, the same one of both images is merged.
+ * @param preview    1 for the full resolution, or 2, 4 or 8 to box-filter the merged rectangle down by that factor.
+ * @param algorithm  The implementation the rectangle is merged with.
+ *
+ * @return              The absolute path to the merged image file, or an empty path if merging failed.
+ */
+    std::filesystem::path
+    merge_images_roi(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                     const std::filesystem::path &out_path, float weight, Bmp::Region const &region,
+                     std::size_t preview = 1, Algorithm algorithm = Algorithm::simd);
+
+/**
+ * Merges two images that are already in memory, without any file I/O. A second image of another size is resampled
+ * to the size of the first one with MergeOptions::resample, and MergeOptions::mask weights every pixel, both always by
+ * the SIMD kernel whatever the algorithm.
+ * Throws std::runtime_error if the images aren't matching.
+ *
+ * @param mode          The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
+ * @param first_image   The first image to merge.
+ * @param second_image  The second image to merge.
+ * @param weight        A float value that determines the blending ratio when weighted blending is used.
+ * @param algorithm     The implementation to merge with, the same one the matching merge_images function uses.
+ *
+ * @return                 The merged image, with the header of the first image.
+ */
+    Bmp merge(BlendMode mode, const Bmp &first_image, const Bmp &second_image, float weight,
+              Algorithm algorithm = Algorithm::simd);
+
+/**
+ * Merges two images that are already in memory with the SIMD kernels, writing into a pooled buffer of the context.
+ * Once the pool holds a free buffer of the output size, a merge does not allocate any heap memory.
+ * Throws std::runtime_error if the images aren't matching.
+ *
+ * @param context       The context whose pool provides the output buffer.
+ * @param mode          The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
+ * @param first_image   The first image to merge.
+ * @param second_image  The second image to merge.
+ * @param weight        A float value that determines the blending ratio when weighted blending is used.
+ *
+ * @return                 The merged image, with the header of the first image and its pixels in the pool.
+ */
+    Bmp merge(MergeContext &context, BlendMode mode, const Bmp &first_image, const Bmp &second_image, float weight);
+
+/**
+ * Merges two images that are already in memory and writes the result, or places a cached result at the output path
+ * without merging if MergeOptions::result_cache is set and the same merge was done before. With Algorithm::simd and
+ * Bmp::WriteMode::map the pixels are blended straight into the mapped output file, without an intermediate buffer.
+ * An output path of "-" writes the image to the standard output and bypasses the result cache.
+ *
+ * @param mode          The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
+ * @param first_image   The first image to merge.
+ * @param second_image  The second image to merge.
+ * @param weight        A float value that determines the blending ratio when weighted blending is used.
+ * @param algorithm     The implementation to merge with on a cache miss.
+ * @param out_path      The path where the merged image will be written.
+ *
+ * @return                 The absolute path to the merged image file, "-" for the standard output, or an empty path
+ *                             if writing failed.
+ */
+    std::filesystem::path merge_to_file(BlendMode mode, const Bmp &first_image, const Bmp &second_image, float weight,
+                                        Algorithm algorithm, const std::filesystem::path &out_path);
+
+/**
+ * Computes the result cache key of a merge.
+ *
+ * @return The key, or an empty optional if no result cache is configured.
+ */
+    std::optional<uint64_t> result_key(BlendMode mode, const Bmp &first_image, const Bmp &second_image, float weight);
+
+/**
+ * Gets the result cache of this merger.
+ *
+ * @return The cache, or nullptr if MergeOptions::result_cache is empty.
+ */
+    ResultCache *getResultCache();
+
+/**
+ * Merges two images into a single image using either weighted or non-weighted blending,
+ * streaming both inputs in bands of MergeOptions::band_rows rows so memory use does not depend on the image size.
+ * The next band is read while the current one is merged and appended to the output.
+ *
+ * @param mode      The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
+ * @param first     The path to the first image to merge.
+ * @param second    The path to the second image to merge.
+ * @param out_path  The path where the merged image will be written.
+ * @param weight    A float value that determines the blending ratio when weighted blending is used.
+ *
+ * @return             The absolute path to the merged image file.
+ */
+    std::filesystem::path
+    merge_images_streaming(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                           const std::filesystem::path &out_path, float weight);
+
+/**
+ * Merges two images into a single image using either weighted or non-weighted blending, re-merging only what changed
+ * since the last call with the same output. A sidecar file next to the output, <out_path>.tiles, keeps checksums of
+ * every MergeOptions::tile_size square tile of both inputs. When the sidecar matches the inputs, the blend settings and
+ * the output file, only tiles whose checksum changed are blended and written over their byte ranges of the existing
+ * output. Otherwise the whole image is merged and the sidecar is rewritten.
+ *
+ * @param mode      The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
+ * @param first     The path to the first image to merge.
+ * @param second    The path to the second image to merge.
+ * @param out_path  The path where the merged image will be written.
+ * @param weight    A float value that determines the blending ratio when weighted blending is used.
+ *
+ * @return             The absolute path to the merged image file.
+ */
+    std::filesystem::path
+    merge_images_incremental(BlendMode mode, const std::filesystem::path &first, const std::filesystem::path &second,
+                             const std::filesystem::path &out_path, float weight);
+
+/**
+ * Crossfades two images that are already in memory into a sequence of frames. The weights of all frames are converted
+ * once, then every cache sized block of the inputs is blended into MergeOptions::frame_group frames before the next
+ * block is read, with the blocks split between the threads of the parallel engine. A group of frames is written on a
+ * background thread while the next group is blended.
+ * Throws std::runtime_error if the images aren't matching or a frame can not be written.
+ *
+ * @param first_image   The first image, shown alone in the first frame.
+ * @param second_image  The second image, shown alone in the last frame.
+ * @param out_path      The path of the output, frame i is written next to it as <stem>_<i><extension>.
+ * @param frames        The number of frames.
+ * @param ramp          The shape of the weight over the frames.
+ *
+ * @return                 The absolute paths to the frames, in order.
+ */
+    std::vector<std::filesystem::path>
+    merge_sequence(const Bmp &first_image, const Bmp &second_image, const std::filesystem::path &out_path,
+                   std::size_t frames, Ramp ramp = Ramp::linear);
+
+/**
+ * Loads two images once and crossfades them into a sequence of frames with merge_sequence.
+ *
+ * @param first     The path to the first image, shown alone in the first frame.
+ * @param second    The path to the second image, shown alone in the last frame.
+ * @param out_path  The path of the output, frame i is written next to it as <stem>_<i><extension>.
+ * @param frames    The number of frames.
+ * @param ramp      The shape of the weight over the frames.
+ *
+ * @return             The absolute paths to the frames, or an empty vector if merging failed.
+ */
+    std::vector<std::filesystem::path>
+    merge_images_sequence(const std::filesystem::path &first, const std::filesystem::path &second,
+                          const std::filesystem::path &out_path, std::size_t frames, Ramp ramp = Ramp::linear);
+
+/**
+ * Merges any number of images into a single image in one pass over memory. The average uses 0.16 fixed-point weights
+ * and 32-bit accumulators, every other mode folds the inputs from left to right, and the rows are split between
+ * OpenMP threads.
+ *
+ * @param mode      The blending operation, e.g. BlendMode::average for weighted blending or BlendMode::max.
+ * @param inputs    The paths to the images to merge, at least one.
+ * @param out_path  The path where the merged image will be written.
+ * @param weights   The relative weight of every input for weighted blending. They are normalised to sum up to one,
+ *                      and all inputs are weighted equally when the vector is empty.
+ *
+ * @return             The absolute path to the merged image file.
+ */
+    std::filesystem::path
+    merge_images_many(BlendMode mode, const std::vector<std::filesystem::path> &inputs, const std::filesystem::path &out_path,
+                      const std::vector<float> &weights = {});
 };
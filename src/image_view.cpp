@@ -0,0 +1,45 @@
+#include <algorithm>
+#include "image_view.h"
+
+namespace {
+
+// the compression values of uncompressed pixels and of 16 and 32-bit pixels with channel masks
+constexpr uint32_t bi_rgb = 0;
+constexpr uint32_t bi_bitfields = 3;
+
+}
+
+std::optional<PixelFormat> pixel_format(const Bmp::BmpHeader &header) {
+    if (header.bits_per_pixel == 24 && header.compression == bi_rgb) {
+        return PixelFormat::bgr24;
+    }
+    if (header.bits_per_pixel == 32 && (header.compression == bi_rgb || header.compression == bi_bitfields)) {
+        return PixelFormat::bgra32;
+    }
+    return std::nullopt;
+}
+
+std::size_t row_stride(const Bmp::BmpHeader &header) {
+    return (static_cast<std::size_t>(std::abs(header.width)) * header.bits_per_pixel + 31) / 32 * 4;
+}
+
+MaskView::MaskView(const Bmp::BmpHeader &header, std::span<const std::byte> pixels)
+        : data(pixels.data()), width(std::abs(header.width)), height(std::abs(header.height)),
+          stride(row_stride(header)), pixel_size(header.bits_per_pixel / 8u), top_down(header.height < 0) {
+    if ((header.bits_per_pixel != 8 && header.bits_per_pixel != 32) ||
+        (header.compression != bi_rgb && header.compression != bi_bitfields)) {
+        throw std::runtime_error("The mask must be an uncompressed 8-bit grayscale or 32-bit image.\n");
+    }
+    if (pixels.size() < stride * height) {
+        throw std::runtime_error("The mask ended before all of its rows were read.\n");
+    }
+}
+
+void MaskView::weights(std::size_t y, std::size_t channels, std::span<std::byte> out) const {
+    auto const *row = data + (top_down ? y : height - 1 - y) * stride;
+    // the alpha of a 32-bit pixel is its last byte
+    std::size_t const channel = pixel_size - 1;
+    for (std::size_t x = 0; x < width; ++x) {
+        std::fill_n(out.begin() + static_cast<std::ptrdiff_t>(x * channels), channels, row[x * pixel_size + channel]);
+    }
+}
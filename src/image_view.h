@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include "bmp.h"
+
+/**
+ * The pixel layouts the format specialised kernels are built for. Both store the channels in blue, green, red order,
+ * bgra32 is followed by an alpha or unused byte and never has row padding.
+ */
+enum class PixelFormat { bgr24, bgra32 };
+
+/**
+ * Finds the pixel format of an image from its header. 32-bit images may use BI_BITFIELDS masks, the bytes are blended
+ * the same way whatever their masks are.
+ *
+ * @param header The header of the image.
+ * @return The format, or an empty optional for compressed images and other bit depths.
+ */
+std::optional<PixelFormat> pixel_format(Bmp::BmpHeader const &header);
+
+/**
+ * Gets the size of a stored pixel row, rows are padded to a multiple of four bytes.
+ *
+ * @param header The header of the image.
+ * @return The distance between the starts of two rows in bytes.
+ */
+std::size_t row_stride(Bmp::BmpHeader const &header);
+
+/**
+ * Calls a function with the pixel format as a compile time constant, so a kernel is instantiated once per format.
+ *
+ * @param format    The pixel format.
+ * @param function  Called as function(std::integral_constant<PixelFormat, format>{}).
+ * @return The value returned by the function.
+ */
+template<typename Function>
+decltype(auto) with_pixel_format(PixelFormat format, Function &&function) {
+    if (format == PixelFormat::bgra32) {
+        return function(std::integral_constant<PixelFormat, PixelFormat::bgra32>{});
+    }
+    return function(std::integral_constant<PixelFormat, PixelFormat::bgr24>{});
+}
+
+/**
+ * A view of the weights of a masked blend, one per pixel. They are read from an uncompressed 8-bit image, whose
+ * palette index is taken as the gray level like in the usual grayscale palette, or from the alpha byte of a 32-bit
+ * image. Rows are addressed from the top like in an ImageView.
+ */
+class MaskView {
+    const std::byte *data{};
+    std::size_t width{};
+    std::size_t height{};
+    std::size_t stride{};
+    std::size_t pixel_size{};
+    bool top_down{};
+
+public:
+    /**
+ * Constructs a view of the pixels of a mask. Throws std::runtime_error if the mask is neither an 8-bit nor a 32-bit
+ * image or the buffer is too short for its rows.
+ *
+ * @param header  The header of the mask.
+ * @param pixels  The pixels of the mask, starting with the first stored row.
+ */
+    MaskView(Bmp::BmpHeader const &header, std::span<const std::byte> pixels);
+
+    [[nodiscard]] std::size_t getWidth() const { return width; }
+
+    [[nodiscard]] std::size_t getHeight() const { return height; }
+
+    /**
+ * Spreads the weights of one row over the channels of the pixels they weight.
+ *
+ * @param y         The row, counted from the top.
+ * @param channels  The bytes per pixel of the blended images.
+ * @param out       Receives width * channels weights.
+ */
+    void weights(std::size_t y, std::size_t channels, std::span<std::byte> out) const;
+};
+
+/**
+ * A typed view of the pixels of an image. Rows are addressed from the top row as the image is displayed, whatever
+ * the order they are stored in, and exclude the padding at their end.
+ *
+ * @tparam Format  The pixel format of the image.
+ * @tparam Byte    const std::byte for a read-only view, std::byte for a view that is written to.
+ */
+template<PixelFormat Format, typename Byte = const std::byte>
+class ImageView {
+    Byte *data{};
+    std::size_t width{};
+    std::size_t height{};
+    std::size_t stride{};
+    bool top_down{};
+
+    [[nodiscard]] std::size_t stored_row(std::size_t y) const { return top_down ? y : height - 1 - y; }
+
+public:
+    static constexpr std::size_t pixel_size = Format == PixelFormat::bgr24 ? 3 : 4;
+
+    /**
+ * Constructs a view of the pixels of an image. Throws std::runtime_error if the image is not of this format or the
+ * buffer is too short for its rows.
+ *
+ * @param header  The header of the image.
+ * @param pixels  The pixels of the image, starting with the first stored row.
+ */
+    ImageView(Bmp::BmpHeader const &header, std::span<Byte> pixels)
+            : data(pixels.data()), width(std::abs(header.width)), height(std::abs(header.height)),
+              stride(row_stride(header)), top_down(header.height < 0) {
+        if (pixel_format(header) != Format || pixels.size() < stride * height) {
+            throw std::runtime_error("Images aren't matching.\n");
+        }
+    }
+
+    [[nodiscard]] std::size_t getWidth() const { return width; }
+
+    [[nodiscard]] std::size_t getHeight() const { return height; }
+
+    [[nodiscard]] std::size_t getStride() const { return stride; }
+
+    [[nodiscard]] bool isTopDown() const { return top_down; }
+
+    /**
+ * Gets the pixels of one row, without its padding.
+ *
+ * @param y The row, counted from the top.
+ * @return The width * pixel_size bytes of the row.
+ */
+    [[nodiscard]] std::span<Byte> row(std::size_t y) const {
+        return {data + stored_row(y) * stride, width * pixel_size};
+    }
+
+    /**
+ * Gets the padding after the pixels of one row.
+ *
+ * @param y The row, counted from the top.
+ * @return The padding bytes, empty for rows of a multiple of four bytes.
+ */
+    [[nodiscard]] std::span<Byte> padding(std::size_t y) const {
+        return {data + stored_row(y) * stride + width * pixel_size, stride - width * pixel_size};
+    }
+
+    /**
+ * Gets a range of rows as they are stored, which is one contiguous run of bytes including the padding.
+ *
+ * @param begin  The first row, counted from the top.
+ * @param end    One past the last row.
+ * @return The bytes of the rows.
+ */
+    [[nodiscard]] std::span<Byte> rows(std::size_t begin, std::size_t end) const {
+        return {data + (top_down ? begin : height - end) * stride, (end - begin) * stride};
+    }
+};
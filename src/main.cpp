@@ -1,73 +1,342 @@
+#include <atomic>
+#include <csignal>
 #include <iostream>
+#include <thread>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
 #include "image_merger.h"
+#include "batch.h"
 #include "bmp.h"
+#include "command_line.h"
+#include "server.h"
+#include "trace.h"
 
+/**
+ * Prints the largest deviation of the fixed-point weighted blend from the float formula for weights in [0.0,1.0].
+ */
+static int verify(Rounding rounding, int steps) {
+    auto const results = verify_blend_range(rounding, steps);
+    int max_from_float = 0;
+    int max_from_exact = 0;
+    std::cout << "weight  max_from_float  max_from_exact  mismatches\n";
+    for (auto const &result: results) {
+        std::cout << std::fixed << std::setprecision(4) << result.weight << "  " << std::setw(14) << result.max_from_float
+                  << "  " << std::setw(14) << result.max_from_exact << "  " << std::setw(10) << result.mismatches << '\n';
+        max_from_float = std::max(max_from_float, result.max_from_float);
+        max_from_exact = std::max(max_from_exact, result.max_from_exact);
+    }
+    std::cout << "Maximum deviation from the float formula: " << max_from_float
+              << ", from the exactly rounded value: " << max_from_exact << std::endl;
+    if (rounding == Rounding::nearest && max_from_exact > 0) {
+        std::cout << "nearest rounds the blend with the weight quantized to 1/256, weights that are not a multiple of "
+                     "1/256 can differ by 1 from the exactly rounded value" << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * Writes the events traced during a command to the path of --trace once the command returns.
+ */
+class TraceFile {
+    std::filesystem::path path;
+    bool chrome;
+
+public:
+    TraceFile(std::filesystem::path path, bool chrome) : path(std::move(path)), chrome(chrome) {}
+
+    ~TraceFile() {
+        if (path.empty()) { return; }
+        std::ofstream out{path};
+        chrome ? trace::write_chrome(out) : trace::write_json(out);
+        if (!out) { std::cerr << "File " << path.string() << " failed to write.\n"; }
+    }
+
+    TraceFile(TraceFile const &) = delete;
+
+    TraceFile &operator=(TraceFile const &) = delete;
+};
+
+static std::atomic<MergeServer *> running_server{nullptr};
+
+static void stop_server(int) {
+    if (auto *server = running_server.load()) { server->stop(); }
+}
 
 int main(int argc, char *argv[]) {
+    if (argc >= 2 && std::string{argv[1]} == "client") {
+        if (argc < 4) {
+            std::cerr << "Error: Incorrect number of arguments\n";
+            std::cout << "Correct input: " << argv[0] << " client <path to socket> <arguments of any other command>..."
+                      << std::endl;
+            return 1;
+        }
+        // everything after the socket is sent as is, with the program name in front like a normal command line
+        std::vector<std::string> command_line{argv[0]};
+        command_line.insert(command_line.end(), argv + 3, argv + argc);
+        return run_client(argv[2], command_line, std::cout, std::cerr);
+    }
+
+    std::map<std::string, std::string> options{};
+    auto const arguments = split_arguments({argv, argv + argc}, options);
+    argc = static_cast<int>(arguments.size());
+
+    MergeOptions merge_options{};
+    if (!parse_merge_options(options, merge_options, std::cerr)) {
+        return 1;
+    }
+    // the numeric options of the serve and batch commands
+    auto const number_option = [&](std::string const &name, auto &value) {
+        if (options.contains(name) && !parse_number(options[name], value)) {
+            std::cerr << "Invalid value for --" << name << ".\n";
+            return false;
+        }
+        return true;
+    };
 
-    if (argc == 2 && std::string(argv[1]) == "help") {
+    if (options.contains("trace-format") && options["trace-format"] != "json" && options["trace-format"] != "chrome") {
+        std::cerr << "Unknown trace format " << options["trace-format"] << ".\n";
+        return 1;
+    }
+    if (options.contains("trace")) {
+        if (!trace::available()) {
+            std::cerr << "Error: this build has no tracer, configure it with -DIMAGE_MERGER_TRACE=ON\n";
+            return 1;
+        }
+        trace::enable(options.contains("trace-counters"));
+    }
+    TraceFile const trace_file{options.contains("trace") ? options["trace"] : "", options["trace-format"] == "chrome"};
+
+    if (argc >= 2 && arguments[1] == "verify") {
+        int steps = 1000;
+        if (argc > 2 && (!parse_number(arguments[2], steps) || steps < 1)) {
+            std::cerr << "The number of verify steps must be a positive integer.\n";
+            return 1;
+        }
+        return verify(merge_options.rounding, steps);
+    }
+
+    if (argc == 2 && arguments[1] == "result-stats") {
+        if (merge_options.result_cache.empty()) {
+            std::cerr << "Error: --result-cache=<directory> is required\n";
+            return 1;
+        }
+        auto const stats = ResultCache{merge_options.result_cache, merge_options.result_cache_bytes}.getStats();
+        std::cout << "hits " << stats.hits << ", misses " << stats.misses << ", stores " << stats.stores
+                  << ", evictions " << stats.evictions << ", " << stats.bytes << " bytes cached" << std::endl;
+        return 0;
+    }
+
+    if (argc >= 2 && arguments[1] == "serve") {
+        if (argc != 3) {
+            std::cerr << "Error: Incorrect number of arguments\n";
+            std::cout << "Correct input: " << argv[0] << " serve <path to socket> [--workers=N] [--cache-mb=N]"
+                      << std::endl;
+            return 1;
+        }
+        ServerOptions server_options{};
+        std::size_t cache_mb = server_options.cache_bytes >> 20;
+        if (!number_option("workers", server_options.workers) || !number_option("cache-mb", cache_mb)) {
+            return 1;
+        }
+        if (cache_mb > std::numeric_limits<std::size_t>::max() >> 20) {
+            std::cerr << "Invalid value for --cache-mb.\n";
+            return 1;
+        }
+        server_options.workers = std::max<std::size_t>(server_options.workers, 1);
+        server_options.cache_bytes = cache_mb << 20;
+        // concurrent requests share the CPUs, so unless told otherwise each merge gets its share of them, unpinned
+        if (!options.contains("threads")) {
+            merge_options.parallel.threads = std::max<int>(1, static_cast<int>(std::thread::hardware_concurrency() /
+                                                                               server_options.workers));
+        }
+        merge_options.parallel.pin = false;
+        try {
+            MergeServer server{arguments[2], merge_options, server_options};
+            running_server = &server;
+            std::signal(SIGINT, stop_server);
+            std::signal(SIGTERM, stop_server);
+            server.run();
+            running_server = nullptr;
+            return 0;
+        } catch (std::exception &e) {
+            std::cerr << e.what();
+            return 1;
+        }
+    }
+
+    if (argc >= 2 && arguments[1] == "batch") {
+        if (argc != 3) {
+            std::cerr << "Error: Incorrect number of arguments\n";
+            std::cout << "Correct input: " << argv[0] << " batch <path to manifest> [--loaders=N] [--writers=N] [--queue=N]"
+                      << std::endl;
+            return 1;
+        }
+        BatchOptions batch_options{};
+        if (!number_option("loaders", batch_options.loaders) || !number_option("writers", batch_options.writers) ||
+            !number_option("queue", batch_options.queue_size)) {
+            return 1;
+        }
+        try {
+            BatchRunner runner{merge_options, batch_options};
+            auto const stats = runner.run(BatchRunner::read_manifest(arguments[2]));
+            std::cout << stats.jobs - stats.failed << "/" << stats.jobs << " jobs in " << stats.seconds << " s, "
+                      << stats.images_per_second() << " images/s, " << stats.megabytes_per_second() << " MB/s" << std::endl;
+            return stats.failed ? 1 : 0;
+        } catch (std::exception &e) {
+            std::cerr << e.what();
+            return 1;
+        }
+    }
+
+    if (argc >= 2 && arguments[1] == "many") {
+        if (argc < 5) {
+            std::cerr << "Error: Incorrect number of arguments\n";
+            std::cout << "Correct input: " << argv[0]
+                      << " many <merging method [average,max,min,...]> <path to output> <path to input>... [--weights=w1,w2,...]"
+                      << std::endl;
+            return 1;
+        }
+        std::vector<std::filesystem::path> inputs(arguments.begin() + 4, arguments.end());
+        std::vector<float> weights{};
+        if (options.contains("weights") && !parse_weights(options["weights"], weights)) {
+            std::cerr << "Invalid value for --weights.\n";
+            return 1;
+        }
+        auto const mode = blend_mode_from_name(arguments[2]);
+        if (!mode) {
+            std::cerr << "Unknown merging method " << arguments[2] << ".\n";
+            return 1;
+        }
+        ImageMerger merger{merge_options};
+        auto const path = merger.merge_images_many(*mode, inputs, arguments[3], weights);
+        std::cout << path << std::endl;
+        return path.empty() ? 1 : 0;
+    }
+
+    if (argc >= 2 && arguments[1] == "sequence") {
+        auto const command = parse_sequence_command(arguments, options, std::cerr);
+        if (!command) {
+            std::cout << "Correct input: " << argv[0]
+                      << " sequence <path to first image> <path to second image> <path to output> <frames> [--ramp=linear|ease]"
+                      << std::endl;
+            return 1;
+        }
+        ImageMerger merger{merge_options};
+        auto const start = std::chrono::high_resolution_clock::now();
+        auto const paths = merger.merge_images_sequence(command->first, command->second, command->output,
+                                                        command->frames, command->ramp);
+        auto const elapsed = std::chrono::high_resolution_clock::now() - start;
+        for (auto const &path: paths) { std::cout << path << '\n'; }
+        std::cout << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / 1000000.0f << std::endl;
+        return paths.empty() ? 1 : 0;
+    }
+
+    if (argc == 2 && arguments[1] == "help") {
         std::cout << "Correct input: " << argv[0]
-                  << " <algorithm version (base, cache, opencl, optimized)> <merging method [average(default),max]> <path to first image> <path to second image> <path to output> <weight> "
+                  << " <algorithm version (base, cache, openmp, optimized, simd, stream, incremental)> <merging method [average(default),max,min,add,subtract,multiply,screen,difference,overlay,linear]> <path to first image> <path to second image> <path to output> <weight> "
                   << std::endl;
         std::cout << "Arguments:\n"
-                  << "  algorithm version: the version of the algorithm to use (base, cache, opencl, optimized)\n"
+                  << "  algorithm version: the version of the algorithm to use (base, cache, openmp, optimized, simd, stream, incremental)\n"
                   << "  merging method: average will return the average pixel value with the added weight, max will take the value of the larger pixel\n"
+                  << "    min takes the smaller pixel, add and subtract saturate, multiply and screen darken or lighten,\n"
+                  << "    difference is the absolute difference and overlay multiplies or screens depending on the first image\n"
+                  << "    linear is the weighted average in linear light, which keeps midtones from darkening\n"
                   << "  path to first image: the path to the first input image file\n"
                   << "  path to second image: the path to the second input image file\n"
                   << "  path to output: the path to the output image file\n"
-                  << "  weight: the weight to use for blending the images (between 0 and 1)\n";
+                  << "  weight: the weight to use for blending the images (between 0 and 1)\n"
+                  << "Options:\n"
+                  << "  --rounding=<truncate|nearest>: rounding of the fixed-point weighted blend (default truncate), nearest\n"
+                  << "    rounds the blend with the weight quantized to 1/256, so it can be off by 1 from exact rounding\n"
+                  << "  --load=<map|read|async>: memory-map the input images, read them into memory, or read both at once\n"
+                  << "    asynchronously, validating their headers before any pixels are read (default map)\n"
+                  << "  --write=<stream|vectored|map|direct>: write the output through an ofstream, with one pwritev call,\n"
+                  << "    by blending straight into the mapped output file (simd only, other versions copy into it), or with\n"
+                  << "    O_DIRECT bypassing the page cache (default stream). An output path of - writes to the standard output\n"
+                  << "  --resample=<none|nearest|bilinear|box>: fit a second image of another size to the first one while\n"
+                  << "    blending, box averages when downscaling (default none, images of different sizes are rejected)\n"
+                  << "  --roi=<x,y,width,height>: merge only this rectangle, y counted from the top, reading only its rows\n"
+                  << "    (base, cache, openmp, optimized and simd only, like --preview)\n"
+                  << "  --preview=<1|2|4|8>: shrink the merged rectangle of --roi by this factor with a box filter (default 1)\n"
+                  << "  --mask=<path>: weight every pixel of the average method by an 8-bit grayscale or 32-bit alpha image of\n"
+                  << "    the same size, 255 keeps the first image (two-image merges only)\n"
+                  << "  --io=<uring|threads>: backend of --load=async, io_uring falls back to threads if unavailable (default uring)\n"
+                  << "  --band-rows=<rows>: rows merged at a time by the stream algorithm version (default 256)\n"
+                  << "  --tile=<pixels>: tile size of the incremental algorithm version, which keeps tile checksums in\n"
+                  << "    <path to output>.tiles and rewrites only the tiles of the output whose inputs changed (default 64)\n"
+                  << "  --trace=<path>: write how long every phase took to a file, e.g. load, merge, blend and write\n"
+                  << "  --trace-format=<json|chrome>: a JSON summary per phase and event, or a chrome://tracing file (default json)\n"
+                  << "  --trace-counters: also count cycles, instructions, LLC and dTLB misses per phase and thread\n"
+                  << "    with perf_event_open\n"
+                  << "  --threads=<count>: number of threads (default: OpenMP default)\n"
+                  << "  --schedule=<static|guided>: page aligned static chunks or guided chunks for the simd kernels (default static)\n"
+                  << "  --no-pin: do not pin worker threads to CPUs\n"
+                  << "  --result-cache=<directory>: reuse the result of an identical earlier merge by linking it to the output\n"
+                  << "  --result-cache-mb=<size>: size limit of the result cache, least recently used results are evicted (default 1024)\n"
+                  << "Merging many images: " << argv[0]
+                  << " many <merging method [average,max,min,...]> <path to output> <path to input>... [--weights=w1,w2,...]\n"
+                  << "Crossfade: " << argv[0]
+                  << " sequence <path to first image> <path to second image> <path to output> <frames> [--ramp=linear|ease]\n"
+                  << "  loads both images once and writes <frames> frames fading from the first to the second image as\n"
+                  << "  <output stem>_000<extension> onwards, --frame-group=N frames per pass over the inputs (default 8)\n"
+                  << "Batch: " << argv[0]
+                  << " batch <path to manifest> [--loaders=N] [--writers=N] [--queue=N] runs one merge per manifest line,\n"
+                  << "  written as <merging method> <path to first image> <path to second image> <path to output> [weight]\n"
+                  << "Server: " << argv[0]
+                  << " serve <path to socket> [--workers=N] [--cache-mb=N] keeps recently used input images in memory\n"
+                  << "  and runs the commands it receives, " << argv[0]
+                  << " client <path to socket> <command>... sends one and prints its result\n"
+                  << "Result cache: " << argv[0] << " result-stats --result-cache=<directory> prints its hits and misses\n"
+                  << "Verification: " << argv[0]
+                  << " verify [steps] [--rounding=...] prints the deviation of the fixed-point blend from the float formula\n";
         return 0;
     }
-    if (argc != 7) {
-
-        std::cerr << "Error: Incorrect number of arguments\n";
+    auto const command = parse_merge_command(arguments, std::cerr);
+    if (!command) {
         std::cout << "Correct input: " << argv[0]
-                  << " <algorithm version (base, cache, openmp, optimized)> <merging method [average(default),max]> <path to first image> <path to second image> <path to output> <weight> "
+                  << " <algorithm version (base, cache, openmp, optimized, simd, stream, incremental)> <merging method [average(default),max,min,add,subtract,multiply,screen,difference,overlay,linear]> <path to first image> <path to second image> <path to output> <weight> "
                   << std::endl;
         return 1;
     }
+    auto const &[algorithm_version, merge_val, first_image, second_image, out_image, weight] = *command;
 
-    std::string algorithm_version = argv[1];
-    int i = 0;
-    std::string merge_method{"average"};
-    if (std::filesystem::path{argv[2]}.extension() != ".bmp") {
-        merge_method = argv[2];
-        ++i;
-    }
-    std::filesystem::path first_image = argv[2 + i];
-    std::filesystem::path second_image = argv[3 + i];
-    std::filesystem::path out_image = argv[4 + i];
-    float weight = std::stof(argv[5 + i]);
-    if (weight > 1.0 || weight < 0.0) {
-        std::cerr << "Weight value must be in range [0.0,1.0].\n";
-        return 1;
-    }
-
+    ImageMerger merger{merge_options};
 
-    ImageMerger merger{};
-
-    int merge_val = (merge_method == "max") ? 0 : 1;
+    // the image itself goes to the standard output when the output path is -, so everything else goes to the error output
+    std::ostream &report = Bmp::is_standard_output(out_image) ? std::cerr : std::cout;
     auto start = std::chrono::high_resolution_clock::now();
 
 
+    // every version returns an empty path when the merge failed, after printing why
+    std::filesystem::path path{};
     if (algorithm_version == "base") {
-        std::cout << merger.merge_images(merge_val, first_image, second_image, out_image, weight) << std::endl;
+        path = merger.merge_images(merge_val, first_image, second_image, out_image, weight);
     } else if (algorithm_version == "openmp") {
-        std::cout << merger.merge_images_openmp(merge_val, first_image, second_image, out_image, weight) << std::endl;
+        path = merger.merge_images_openmp(merge_val, first_image, second_image, out_image, weight);
     } else if (algorithm_version == "cache") {
-        std::cout << merger.merge_images_cache(merge_val, first_image, second_image, out_image, weight) << std::endl;
+        path = merger.merge_images_cache(merge_val, first_image, second_image, out_image, weight);
     } else if (algorithm_version == "optimized") {
-        std::cout << merger.merge_images_optimized(merge_val, first_image, second_image, out_image, weight)
-                  << std::endl;
+        path = merger.merge_images_optimized(merge_val, first_image, second_image, out_image, weight);
+    } else if (algorithm_version == "simd") {
+        path = merger.merge_images_simd(merge_val, first_image, second_image, out_image, weight);
+    } else if (algorithm_version == "stream") {
+        path = merger.merge_images_streaming(merge_val, first_image, second_image, out_image, weight);
+    } else if (algorithm_version == "incremental") {
+        path = merger.merge_images_incremental(merge_val, first_image, second_image, out_image, weight);
     } else {
-        std::cout << "Entered argument <" << algorithm_version
-                  << "> is invalid. Supported algorithm versions are <base>, <openmp>, <cache> and <optimized>"
-                  << std::endl;
+        report << "Entered argument <" << algorithm_version
+               << "> is invalid. Supported algorithm versions are <base>, <openmp>, <cache>, <optimized>, <simd>, <stream> and <incremental>"
+               << std::endl;
+        return 1;
     }
+    report << path << std::endl;
 
     auto end = std::chrono::high_resolution_clock::now();
     auto elapsed_time = duration_cast<std::chrono::nanoseconds>(end - start);
-    std::cout << elapsed_time.count() / 1000000.0f << std::endl;
+    report << elapsed_time.count() / 1000000.0f << std::endl;
 
-    return 0;
+    return path.empty() ? 1 : 0;
 }
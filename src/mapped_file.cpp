@@ -0,0 +1,37 @@
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+
+MappedFile::MappedFile(const std::filesystem::path &path) {
+    int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("File " + path.string() + " failed to open.\n");
+    }
+    struct stat info{};
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("File " + path.string() + " is empty or can not be read.\n");
+    }
+    size = static_cast<std::size_t>(info.st_size);
+    void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("File " + path.string() + " failed to map.\n");
+    }
+    data = static_cast<std::byte *>(mapping);
+    // both are hints, kernels without transparent huge pages for files simply reject the second one
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+    ::madvise(mapping, size, MADV_HUGEPAGE);
+}
+
+MappedFile::~MappedFile() {
+    if (data) { ::munmap(data, size); }
+}
+
+std::span<const std::byte> MappedFile::getBytes() const {
+    return {data, size};
+}
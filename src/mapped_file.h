@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+/**
+ * A read-only memory mapping of a whole file. The mapping is released when the object is destroyed.
+ */
+class MappedFile {
+    std::byte *data{nullptr};
+    std::size_t size{0};
+
+public:
+    /**
+ * Maps a file into memory and advises the kernel that it will be read sequentially.
+ * Throws std::runtime_error if the file can not be opened or mapped.
+ *
+ * @param path The path of the file to map.
+ */
+    explicit MappedFile(std::filesystem::path const &path);
+
+    MappedFile(MappedFile const &) = delete;
+
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    ~MappedFile();
+
+    /**
+ * Gets the contents of the mapped file.
+ *
+ * @return A span over the mapped bytes, valid for the lifetime of this object.
+ */
+    [[nodiscard]] std::span<const std::byte> getBytes() const;
+};
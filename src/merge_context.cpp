@@ -0,0 +1,57 @@
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "merge_context.h"
+#include "trace.h"
+
+namespace {
+
+/**
+ * Reads exactly size bytes at the given offset, retrying short reads.
+ */
+bool read_fully(int fd, std::byte *data, std::size_t size, off_t offset) {
+    while (size > 0) {
+        auto const count = pread(fd, data, size, offset);
+        if (count <= 0) { return false; }
+        data += count;
+        size -= static_cast<std::size_t>(count);
+        offset += count;
+    }
+    return true;
+}
+
+}
+
+MergeContext::MergeContext(std::size_t alignment) : pool(alignment) {}
+
+Bmp MergeContext::load(const std::filesystem::path &image_path) {
+    TRACE_SCOPE("load");
+    int const fd = open(image_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("File " + image_path.string() + " failed to open.\n");
+    }
+    struct stat status{};
+    Bmp::BmpHeader header{};
+    bool valid = fstat(fd, &status) == 0 && read_fully(fd, reinterpret_cast<std::byte *>(&header), sizeof(header), 0) &&
+                 header.signature == 0x4d42 && header.offset >= sizeof(header) &&
+                 header.offset <= static_cast<std::size_t>(status.st_size);
+    std::shared_ptr<AlignedBuffer> pixels{};
+    if (valid) {
+        pixels = pool.acquire(static_cast<std::size_t>(status.st_size) - header.offset);
+        valid = read_fully(fd, pixels->getBytes().data(), pixels->getBytes().size(), header.offset);
+    }
+    close(fd);
+    if (!valid) {
+        throw std::runtime_error("File " + image_path.string() + " is not a readable bmp image.\n");
+    }
+    return Bmp{header, std::move(pixels)};
+}
+
+std::shared_ptr<AlignedBuffer> MergeContext::acquire(std::size_t size) {
+    return pool.acquire(size);
+}
+
+BufferPool &MergeContext::getPool() {
+    return pool;
+}
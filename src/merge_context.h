@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include "aligned_buffer.h"
+#include "bmp.h"
+#include "buffer_pool.h"
+
+/**
+ * State that is reused across merges, so a worker merging images of the same size over and over does not allocate
+ * after its first merge. Input and output pixels live in pooled aligned buffers, which return to the pool once the
+ * last Bmp using them is destroyed. A context may be shared between threads.
+ */
+class MergeContext {
+    BufferPool pool;
+
+public:
+    /**
+ * Constructs a context with an empty pool.
+ *
+ * @param alignment The alignment of the pooled buffers, AlignedBuffer::cache_line, page or huge_page.
+ */
+    explicit MergeContext(std::size_t alignment = AlignedBuffer::page);
+
+    /**
+ * Reads an image into a pooled buffer with plain read calls, without any heap allocation once the pool holds a free
+ * buffer of the right size. Throws std::runtime_error if the file can not be read or is not a bmp image.
+ *
+ * @param image_path The path of the image file to load.
+ * @return The image, sharing its pixels with the pool.
+ */
+    Bmp load(std::filesystem::path const &image_path);
+
+    /**
+ * Gets a pooled buffer for pixels, e.g. the output of a merge.
+ *
+ * @param size The number of bytes.
+ * @return The buffer, returned to the pool once it is released.
+ */
+    std::shared_ptr<AlignedBuffer> acquire(std::size_t size);
+
+    /**
+ * Gets the pool of this context.
+ *
+ * @return A reference to the buffer pool.
+ */
+    BufferPool &getPool();
+};
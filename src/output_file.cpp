@@ -0,0 +1,40 @@
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "output_file.h"
+
+OutputFile::OutputFile(const std::filesystem::path &path, std::size_t size) : size(size) {
+    int const fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("File " + path.string() + " failed to open.\n");
+    }
+    // fallocate reserves the blocks so a full disk fails here rather than as SIGBUS on a store into the mapping
+    int const allocated = ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+    if ((allocated != 0 && allocated != EOPNOTSUPP && allocated != EINVAL) ||
+        ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("File " + path.string() + " failed to grow to " + std::to_string(size) + " bytes.\n");
+    }
+    if (size == 0) {
+        ::close(fd);
+        return;
+    }
+    void *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("File " + path.string() + " failed to map.\n");
+    }
+    data = static_cast<std::byte *>(mapping);
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+}
+
+OutputFile::~OutputFile() {
+    if (data) { ::munmap(data, size); }
+}
+
+std::span<std::byte> OutputFile::getBytes() {
+    return {data, size};
+}
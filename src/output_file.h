@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+/**
+ * A writable shared memory mapping of a new file of a fixed size. The file is created or truncated, its blocks are
+ * allocated up front where the file system supports it, and whatever is stored into the mapping ends up in the file
+ * without another copy. The mapping is released when the object is destroyed.
+ */
+class OutputFile {
+    std::byte *data{nullptr};
+    std::size_t size{0};
+
+public:
+    /**
+ * Creates the file and maps it. Throws std::runtime_error if the file can not be created, sized or mapped.
+ *
+ * @param path  The path of the file to create. An existing file at this path is replaced.
+ * @param size  The size of the file in bytes.
+ */
+    OutputFile(std::filesystem::path const &path, std::size_t size);
+
+    OutputFile(OutputFile const &) = delete;
+
+    OutputFile &operator=(OutputFile const &) = delete;
+
+    ~OutputFile();
+
+    /**
+ * Gets the contents of the mapped file, zeroed until they are written.
+ *
+ * @return A span over the mapped bytes, valid for the lifetime of this object.
+ */
+    [[nodiscard]] std::span<std::byte> getBytes();
+};
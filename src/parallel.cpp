@@ -0,0 +1,35 @@
+#include <sched.h>
+#include "parallel.h"
+
+ParallelEngine::ParallelEngine(ParallelOptions options) : options(options) {}
+
+int ParallelEngine::threads() const {
+    return options.threads > 0 ? options.threads : omp_get_max_threads();
+}
+
+void ParallelEngine::pin_current_thread() const {
+    // the calling thread stays unpinned, threads it starts later would otherwise inherit a single CPU
+    int const thread = omp_get_thread_num();
+    if (!options.pin || thread == 0) { return; }
+    // OpenMP keeps its worker threads alive between regions, so every thread is pinned only once
+    thread_local int pinned_to = -1;
+    if (pinned_to == thread) { return; }
+
+    static cpu_set_t const allowed = [] {
+        cpu_set_t ret{};
+        if (sched_getaffinity(0, sizeof(ret), &ret) != 0) { CPU_ZERO(&ret); }
+        return ret;
+    }();
+    int const cpus = CPU_COUNT(&allowed);
+    if (cpus <= 1) { return; }
+    int target = thread % cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) { continue; }
+        if (target-- == 0) {
+            cpu_set_t single{};
+            CPU_SET(cpu, &single);
+            if (sched_setaffinity(0, sizeof(single), &single) == 0) { pinned_to = thread; }
+            return;
+        }
+    }
+}
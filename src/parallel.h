@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <omp.h>
+
+/**
+ * How a range is split between the threads of a ParallelEngine.
+ * static gives every thread one contiguous chunk, guided hands out shrinking chunks on demand.
+ */
+enum class Schedule { static_chunks, guided };
+
+/**
+ * Settings of a ParallelEngine.
+ */
+struct ParallelOptions {
+    int threads{0};
+    Schedule schedule{Schedule::static_chunks};
+    bool pin{true};
+    std::size_t grain{4096};
+};
+
+/**
+ * Runs work on a single flat OpenMP team. Chunk boundaries are multiples of the grain (a page by default), so no
+ * two threads write to the same page or cache line, and with the static schedule a buffer that is first written
+ * inside for_chunks ends up on the NUMA node of the thread that writes it. Worker threads can be pinned to the CPUs
+ * the process may run on, one CPU per thread, while the calling thread keeps its affinity.
+ */
+class ParallelEngine {
+    ParallelOptions options;
+
+    void pin_current_thread() const;
+
+public:
+    explicit ParallelEngine(ParallelOptions options = {});
+
+    /**
+ * Gets the number of threads a parallel region of this engine uses.
+ *
+ * @return The configured thread count, or the OpenMP default if none was configured.
+ */
+    [[nodiscard]] int threads() const;
+
+    /**
+ * Calls a function for disjoint chunks that together cover the range [0, size), from all threads of one team.
+ *
+ * @param size      The size of the range.
+ * @param function  Called as function(begin, end) for every chunk.
+ */
+    template<typename Function>
+    void for_chunks(std::size_t size, Function &&function) const {
+        std::size_t const grain = std::max<std::size_t>(options.grain, 1);
+        if (options.schedule == Schedule::guided) {
+            long const blocks = static_cast<long>((size + grain - 1) / grain);
+#pragma omp parallel num_threads(threads()) default(shared)
+            {
+                pin_current_thread();
+#pragma omp for schedule(guided)
+                for (long block = 0; block < blocks; ++block) {
+                    std::size_t const begin = static_cast<std::size_t>(block) * grain;
+                    function(begin, std::min(size, begin + grain));
+                }
+            }
+            return;
+        }
+#pragma omp parallel num_threads(threads()) default(shared)
+        {
+            pin_current_thread();
+            std::size_t const team = omp_get_num_threads();
+            std::size_t const chunk = ((size + team - 1) / team + grain - 1) / grain * grain;
+            std::size_t const begin = std::min(size, chunk * omp_get_thread_num());
+            std::size_t const end = std::min(size, begin + chunk);
+            if (begin < end) { function(begin, end); }
+        }
+    }
+};
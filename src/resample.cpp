@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <immintrin.h>
+#include "resample.h"
+
+namespace {
+
+constexpr uint32_t weight_bits = 14;
+constexpr uint32_t one = 1u << weight_bits;
+// the vertical sums are narrowed by this many bits before the horizontal pass, so they fit into signed 16 bits and
+// both passes into 32 bits
+constexpr uint32_t narrow_bits = 7;
+
+/**
+ * Calls a function with the bytes per pixel as a compile time constant for the common 3 and 4, or 0 for any other
+ * size, which the function then reads at run time.
+ */
+template<typename Function>
+void with_channels(std::size_t bytes_per_pixel, Function &&function) {
+    if (bytes_per_pixel == 3) {
+        function(std::integral_constant<std::size_t, 3>{});
+    } else if (bytes_per_pixel == 4) {
+        function(std::integral_constant<std::size_t, 4>{});
+    } else {
+        function(std::integral_constant<std::size_t, 0>{});
+    }
+}
+
+/**
+ * Copies the pixel of every output column from a source row.
+ */
+template<std::size_t Channels>
+void gather(std::span<const uint32_t> first, uint8_t const *line, std::size_t bytes_per_pixel, uint8_t *out) {
+    std::size_t const channels = Channels ? Channels : bytes_per_pixel;
+    for (std::size_t x = 0; x < first.size(); ++x) {
+        for (std::size_t c = 0; c < channels; ++c) { out[x * channels + c] = line[first[x] * channels + c]; }
+    }
+}
+
+/**
+ * Filters the narrowed vertical sums of a row horizontally into bytes. The 3 and 4 byte pixels keep their channels
+ * in the 32-bit lanes of one SSE2 register and multiply-add two taps at once, interleaved into 16-bit pairs, a 3 byte
+ * pixel reads one sum past itself, which the scratch buffer is padded for. Every other size is filtered channel by
+ * channel.
+ */
+template<std::size_t Channels>
+void filter_horizontally(std::span<const uint32_t> first, uint16_t const *weights, std::size_t taps,
+                         uint16_t const *sums, std::size_t bytes_per_pixel, uint8_t *out) {
+    constexpr uint32_t shift = 2 * weight_bits - narrow_bits;
+    if constexpr (Channels == 0) {
+        for (std::size_t x = 0; x < first.size(); ++x, weights += taps) {
+            uint16_t const *const pixel = sums + first[x] * bytes_per_pixel;
+            for (std::size_t c = 0; c < bytes_per_pixel; ++c) {
+                uint32_t sum = 1u << (shift - 1);
+                for (std::size_t k = 0; k < taps; ++k) { sum += weights[k] * pixel[k * bytes_per_pixel + c]; }
+                out[x * bytes_per_pixel + c] = static_cast<uint8_t>(std::min<uint32_t>(sum >> shift, 255));
+            }
+        }
+    } else {
+        auto const load = [](uint16_t const *data) {
+            return _mm_loadl_epi64(reinterpret_cast<__m128i const *>(data));
+        };
+        for (std::size_t x = 0; x < first.size(); ++x, weights += taps) {
+            uint16_t const *const pixel = sums + first[x] * Channels;
+            __m128i sum = _mm_set1_epi32(1 << (shift - 1));
+            std::size_t k = 0;
+            for (; k + 1 < taps; k += 2) {
+                __m128i const pair = _mm_unpacklo_epi16(load(pixel + k * Channels), load(pixel + (k + 1) * Channels));
+                __m128i const weight = _mm_set1_epi32(static_cast<int>(weights[k] | weights[k + 1] << 16));
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(pair, weight));
+            }
+            if (k < taps) {
+                __m128i const pair = _mm_unpacklo_epi16(load(pixel + k * Channels), _mm_setzero_si128());
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(pair, _mm_set1_epi32(weights[k])));
+            }
+            sum = _mm_srli_epi32(sum, shift);
+            sum = _mm_packus_epi16(_mm_packs_epi32(sum, sum), sum);
+            auto const bytes = static_cast<uint32_t>(_mm_cvtsi128_si32(sum));
+            std::memcpy(out + x * Channels, &bytes, Channels);
+        }
+    }
+}
+
+}
+
+std::optional<Resample> resample_from_name(std::string_view name) {
+    if (name == "none") { return Resample::none; }
+    if (name == "nearest") { return Resample::nearest; }
+    if (name == "bilinear") { return Resample::bilinear; }
+    if (name == "box") { return Resample::box; }
+    return std::nullopt;
+}
+
+Resampler::Axis Resampler::make_axis(Resample filter, std::size_t source, std::size_t target) {
+    double const scale = static_cast<double>(source) / static_cast<double>(target);
+    auto const last = static_cast<double>(source - 1);
+    auto const bilinear_position = [&](std::size_t i) {
+        return std::clamp((static_cast<double>(i) + 0.5) * scale - 0.5, 0.0, last);
+    };
+    // the source coordinates [begin, end) output coordinate i reads
+    auto const window = [&](std::size_t i) -> std::pair<std::size_t, std::size_t> {
+        if (filter == Resample::nearest) {
+            auto const j = std::min(static_cast<std::size_t>((static_cast<double>(i) + 0.5) * scale), source - 1);
+            return {j, j + 1};
+        }
+        if (filter == Resample::bilinear) {
+            auto const low = static_cast<std::size_t>(bilinear_position(i));
+            return {low, std::min(low + 2, source)};
+        }
+        double const end = std::min(static_cast<double>(i + 1) * scale, static_cast<double>(source));
+        return {static_cast<std::size_t>(static_cast<double>(i) * scale),
+                std::min(static_cast<std::size_t>(std::ceil(end)), source)};
+    };
+    // the exact weight of source coordinate j in output coordinate i
+    auto const weight = [&](std::size_t i, std::size_t j) {
+        if (filter == Resample::nearest) { return 1.0; }
+        if (filter == Resample::bilinear) {
+            double const position = bilinear_position(i);
+            double const fraction = position - std::floor(position);
+            return j == static_cast<std::size_t>(position) ? 1.0 - fraction : fraction;
+        }
+        // every source pixel weighs as much as it overlaps the output pixel
+        double const begin = static_cast<double>(i) * scale;
+        double const end = std::min(static_cast<double>(i + 1) * scale, static_cast<double>(source));
+        double const overlap = std::min(end, static_cast<double>(j + 1)) - std::max(begin, static_cast<double>(j));
+        return std::max(overlap, 0.0) / scale;
+    };
+
+    // two passes over the windows fill flat tables, the first only finds the widest one
+    Axis ret{};
+    for (std::size_t i = 0; i < target; ++i) {
+        auto const [begin, end] = window(i);
+        ret.taps = std::max(ret.taps, end - begin);
+    }
+    ret.first.resize(target);
+    ret.weights.assign(target * ret.taps, 0);
+    for (std::size_t i = 0; i < target; ++i) {
+        auto const [begin, end] = window(i);
+        // the window is moved back at the far edge, so every tap reads inside the source
+        ret.first[i] = static_cast<uint32_t>(std::min(begin, source - ret.taps));
+        auto const weights = std::span(ret.weights).subspan(i * ret.taps, ret.taps);
+        // every weight is the step between two rounded running sums, so none can go negative, whatever the number of
+        // taps, and they add up to exactly one, so a flat image stays flat
+        double total = 0;
+        for (std::size_t j = begin; j < end; ++j) { total += weight(i, j); }
+        double running = 0;
+        uint32_t rounded = 0;
+        for (std::size_t j = begin; j < end; ++j) {
+            running += weight(i, j);
+            auto const next = j + 1 == end ? one : static_cast<uint32_t>(std::lround(running / total * one));
+            weights[j - ret.first[i]] = static_cast<uint16_t>(next - rounded);
+            rounded = next;
+        }
+    }
+    return ret;
+}
+
+Resampler::Resampler(Resample filter, std::size_t source_width, std::size_t source_height, std::size_t target_width,
+                     std::size_t target_height, std::size_t bytes_per_pixel) : bytes_per_pixel(bytes_per_pixel),
+                                                                               source_width(source_width),
+                                                                               source_height(source_height) {
+    if (filter == Resample::none) {
+        throw std::runtime_error("Images aren't matching.\n");
+    }
+    if (source_width == 0 || source_height == 0 || target_width == 0 || target_height == 0) {
+        throw std::runtime_error("Images without pixels can not be resampled.\n");
+    }
+    columns = make_axis(filter, source_width, target_width);
+    rows = make_axis(filter, source_height, target_height);
+}
+
+void Resampler::row(std::span<const std::byte> source, std::size_t source_row_size, std::size_t y, bool flip,
+                    Scratch &scratch, std::span<std::byte> out) const {
+    auto const source_line = [&](std::size_t j) {
+        return reinterpret_cast<uint8_t const *>(source.data() + (flip ? source_height - 1 - j : j) * source_row_size);
+    };
+    auto *const out_bytes = reinterpret_cast<uint8_t *>(out.data());
+    if (rows.taps == 1 && columns.taps == 1) {
+        // nearest, or a box of at most one source pixel, is a plain gather without any arithmetic
+        with_channels(bytes_per_pixel, [&](auto channels) {
+            gather<channels>(columns.first, source_line(rows.first[y]), bytes_per_pixel, out_bytes);
+        });
+        return;
+    }
+
+    // the vertical taps are summed over blocks that stay in the first level cache, one source row after the other,
+    // and every block is narrowed to 16 bits right away
+    std::size_t const width = source_width * bytes_per_pixel;
+    scratch.resize(width + 1);
+    uint16_t *const sums = scratch.data();
+    uint16_t const *const weights = rows.weights.data() + y * rows.taps;
+    std::array<uint32_t, 512> block{};
+    for (std::size_t begin = 0; begin < width; begin += block.size()) {
+        std::size_t const size = std::min(block.size(), width - begin);
+        block.fill(1u << (narrow_bits - 1));
+        for (std::size_t k = 0; k < rows.taps; ++k) {
+            uint32_t const weight = weights[k];
+            uint8_t const *const line = source_line(rows.first[y] + k) + begin;
+#pragma omp simd
+            for (std::size_t i = 0; i < size; ++i) { block[i] += weight * static_cast<uint16_t>(line[i]); }
+        }
+        for (std::size_t i = 0; i < size; ++i) { sums[begin + i] = static_cast<uint16_t>(block[i] >> narrow_bits); }
+    }
+
+    with_channels(bytes_per_pixel, [&](auto channels) {
+        filter_horizontally<channels>(columns.first, columns.weights.data(), columns.taps, sums, bytes_per_pixel,
+                                      out_bytes);
+    });
+}
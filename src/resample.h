@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/**
+ * How the second image of a merge is resampled to the size of the first one. none keeps the images required to
+ * match, nearest picks the closest source pixel, bilinear interpolates between the four closest ones, and box
+ * averages every source pixel the output pixel covers, which is the one to use for downscaling.
+ */
+enum class Resample { none, nearest, bilinear, box };
+
+/**
+ * Finds the resampling filter with the given command line name.
+ *
+ * @param name The name of the filter, e.g. "bilinear".
+ * @return The filter, or an empty optional if no filter has this name.
+ */
+std::optional<Resample> resample_from_name(std::string_view name);
+
+/**
+ * Produces the rows of a resampled image one at a time, without ever holding the whole resampled image. The source
+ * coordinates and 2.14 fixed-point weights of every output column and row are computed once into flat tables. A row
+ * is filtered vertically into sums over the source width, narrowed to 16 bits, and then horizontally into bytes.
+ */
+class Resampler {
+    // the taps of one axis, output coordinate i reads taps source coordinates from first[i] on
+    struct Axis {
+        std::size_t taps{1};
+        std::vector<uint32_t> first{};
+        std::vector<uint16_t> weights{};
+    };
+
+    Axis columns;
+    Axis rows;
+    std::size_t bytes_per_pixel;
+    std::size_t source_width;
+    std::size_t source_height;
+
+    static Axis make_axis(Resample filter, std::size_t source, std::size_t target);
+
+public:
+    /**
+ * The per-thread buffer of row.
+ */
+    using Scratch = std::vector<uint16_t>;
+
+    /**
+ * Computes the coordinate and weight tables. Throws std::runtime_error for Resample::none or an empty image.
+ *
+ * @param filter           The filter.
+ * @param source_width     The width of the source image in pixels.
+ * @param source_height    The height of the source image in pixels.
+ * @param target_width     The width of the resampled image in pixels.
+ * @param target_height    The height of the resampled image in pixels.
+ * @param bytes_per_pixel  The size of a pixel in both images, every byte is filtered as its own channel.
+ */
+    Resampler(Resample filter, std::size_t source_width, std::size_t source_height, std::size_t target_width,
+              std::size_t target_height, std::size_t bytes_per_pixel);
+
+    /**
+ * Resamples one row.
+ *
+ * @param source           The pixels of the source image.
+ * @param source_row_size  The size of a source row in bytes, including its padding.
+ * @param y                The resampled row.
+ * @param flip             Whether the source rows are stored in the opposite vertical order of the resampled ones.
+ * @param scratch          A buffer reused between the calls of one thread.
+ * @param out              Receives the pixels of the row, the bytes after them are left unchanged.
+ */
+    void row(std::span<const std::byte> source, std::size_t source_row_size, std::size_t y, bool flip,
+             Scratch &scratch, std::span<std::byte> out) const;
+};
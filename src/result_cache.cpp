@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sstream>
+#include <string>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "hash.h"
+#include "result_cache.h"
+
+namespace {
+
+// bumped whenever the kernels change their output, so old entries are never hit again
+constexpr uint64_t format_version = 1;
+
+/**
+ * Makes target a reflink of source, sharing its blocks until either is written.
+ */
+bool reflink(std::filesystem::path const &source, std::filesystem::path const &target) {
+    int const in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) { return false; }
+    int const out = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    bool const ret = out >= 0 && ioctl(out, FICLONE, in) == 0;
+    if (out >= 0) { close(out); }
+    close(in);
+    if (!ret && out >= 0) { unlink(target.c_str()); }
+    return ret;
+}
+
+/**
+ * Places source at target, preferring operations that do not copy any data.
+ */
+bool place(std::filesystem::path const &source, std::filesystem::path const &target) {
+    if (reflink(source, target) || link(source.c_str(), target.c_str()) == 0) { return true; }
+    std::error_code error{};
+    return std::filesystem::copy_file(source, target, std::filesystem::copy_options::overwrite_existing, error);
+}
+
+}
+
+ResultCache::ResultCache(std::filesystem::path directory, std::size_t capacity) : directory(std::move(directory)),
+                                                                                  capacity(capacity) {
+    std::filesystem::create_directories(this->directory);
+}
+
+std::filesystem::path ResultCache::entry_path(uint64_t key) const {
+    std::array<char, 17> name{};
+    std::snprintf(name.data(), name.size(), "%016llx", static_cast<unsigned long long>(key));
+    return directory / (std::string{name.data()} + ".bmp");
+}
+
+template<typename Function>
+ResultCacheStats ResultCache::update(Function &&function) const {
+    auto const path = directory / "stats";
+    int const fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("File " + path.string() + " failed to open.\n");
+    }
+    flock(fd, LOCK_EX);
+    std::string text(256, '\0');
+    auto const count = pread(fd, text.data(), text.size(), 0);
+    text.resize(count > 0 ? static_cast<std::size_t>(count) : 0);
+    ResultCacheStats stats{};
+    std::istringstream{text} >> stats.hits >> stats.misses >> stats.stores >> stats.evictions >> stats.bytes;
+
+    if (function(stats)) {
+        auto const updated = std::to_string(stats.hits) + " " + std::to_string(stats.misses) + " " +
+                             std::to_string(stats.stores) + " " + std::to_string(stats.evictions) + " " +
+                             std::to_string(stats.bytes) + "\n";
+        if (pwrite(fd, updated.data(), updated.size(), 0) == static_cast<ssize_t>(updated.size())) {
+            ftruncate(fd, static_cast<off_t>(updated.size()));
+        }
+    }
+    close(fd);
+    return stats;
+}
+
+uint64_t ResultCache::key(BlendMode mode, FixedWeight weight, const Bmp &first, const Bmp &second, int threads,
+                          uint64_t variant) {
+    if (!uses_weight(mode)) { weight = {}; }
+    auto const &header = first.getHeader();
+    std::array<uint64_t, 9> const fields{format_version,
+                                         hash_blocks(first.getPixels(), threads),
+                                         hash_blocks(second.getPixels(), threads),
+                                         second.getPixels().size(),
+                                         xxh64(std::as_bytes(std::span(&header, 1))),
+                                         static_cast<uint64_t>(mode),
+                                         static_cast<uint64_t>(weight.first) << 16 | weight.second,
+                                         weight.bias,
+                                         variant};
+    return xxh64(std::as_bytes(std::span(fields)));
+}
+
+bool ResultCache::fetch(uint64_t key, const std::filesystem::path &out_path) {
+    auto const entry = entry_path(key);
+    std::error_code error{};
+    bool hit = std::filesystem::exists(entry, error);
+    if (hit) {
+        std::filesystem::remove(out_path, error);
+        hit = place(entry, out_path);
+        // the modification time of an entry is its last use, which eviction goes by
+        utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+    }
+    update([&](ResultCacheStats &stats) {
+        ++(hit ? stats.hits : stats.misses);
+        return true;
+    });
+    return hit;
+}
+
+void ResultCache::store(uint64_t key, const std::filesystem::path &out_path) {
+    auto const entry = entry_path(key);
+    std::ostringstream suffix{};
+    suffix << ".tmp." << getpid() << "." << std::this_thread::get_id();
+    auto const temporary = std::filesystem::path{entry.string() + suffix.str()};
+    std::error_code error{};
+    if (!place(out_path, temporary)) {
+        std::filesystem::remove(temporary, error);
+        return;
+    }
+    auto const size = std::filesystem::file_size(temporary, error);
+    // renamed into place, so other processes never see a partial entry
+    std::filesystem::rename(temporary, entry, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return;
+    }
+
+    update([&](ResultCacheStats &stats) {
+        ++stats.stores;
+        stats.bytes += size;
+        if (stats.bytes <= capacity) { return true; }
+
+        struct Entry {
+            std::filesystem::path path;
+            std::filesystem::file_time_type used;
+            std::size_t size;
+        };
+        std::vector<Entry> entries{};
+        stats.bytes = 0;
+        for (auto const &file: std::filesystem::directory_iterator{directory, error}) {
+            if (file.path().extension() != ".bmp") { continue; }
+            entries.push_back({file.path(), file.last_write_time(error), file.file_size(error)});
+            stats.bytes += entries.back().size;
+        }
+        std::sort(entries.begin(), entries.end(), [](auto const &a, auto const &b) { return a.used < b.used; });
+        for (auto const &old: entries) {
+            if (stats.bytes <= capacity) { break; }
+            if (old.path == entry) { continue; }
+            if (std::filesystem::remove(old.path, error)) {
+                stats.bytes -= old.size;
+                ++stats.evictions;
+            }
+        }
+        return true;
+    });
+}
+
+ResultCacheStats ResultCache::getStats() const {
+    return update([](ResultCacheStats &) { return false; });
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include "blend.h"
+#include "bmp.h"
+
+/**
+ * Counters of a ResultCache, shared by every process using the same directory.
+ */
+struct ResultCacheStats {
+    std::size_t hits{};
+    std::size_t misses{};
+    std::size_t stores{};
+    std::size_t evictions{};
+    std::size_t bytes{};
+};
+
+/**
+ * An on-disk cache of merged images, addressed by a hash of both input pixel buffers, the header of the output, the
+ * blend mode and the fixed-point weight. A hit places the cached file at the output path as a reflink, a hard link
+ * or, on file systems that support neither, a copy, without running a kernel. Entries are evicted least recently used
+ * first once the directory grows beyond its size limit. Processes sharing a directory serialise on a lock file.
+ *
+ * A hard-linked output shares its inode with the cache entry, so it must be replaced rather than rewritten in place.
+ * Bmp::write_image does that for files with more than one link.
+ */
+class ResultCache {
+    std::filesystem::path directory;
+    std::size_t capacity;
+
+    template<typename Function>
+    ResultCacheStats update(Function &&function) const;
+
+    [[nodiscard]] std::filesystem::path entry_path(uint64_t key) const;
+
+public:
+    /**
+ * Opens a cache directory, creating it if needed.
+ *
+ * @param directory  The directory holding the cached images.
+ * @param capacity   The largest total size of the cached images in bytes.
+ */
+    ResultCache(std::filesystem::path directory, std::size_t capacity);
+
+    /**
+ * Computes the key of a merge. The weight is ignored by modes that do not use it.
+ *
+ * @param mode      The blend mode.
+ * @param weight    The fixed-point weight, including its rounding bias.
+ * @param first     The first input image.
+ * @param second    The second input image.
+ * @param threads   The number of threads hashing the pixels.
+ * @param variant   Any other setting that changes the result, e.g. how a second image of another size is resampled.
+ * @return The key.
+ */
+    static uint64_t key(BlendMode mode, FixedWeight weight, Bmp const &first, Bmp const &second, int threads,
+                        uint64_t variant = 0);
+
+    /**
+ * Places a cached result at the output path if there is one. An existing file at the output path is replaced.
+ *
+ * @param key       The key of the merge.
+ * @param out_path  The path the merged image should be written to.
+ * @return Whether the result was cached and is now at the output path.
+ */
+    bool fetch(uint64_t key, std::filesystem::path const &out_path);
+
+    /**
+ * Adds a merged image that was just written, then evicts the least recently used entries beyond the size limit.
+ *
+ * @param key       The key of the merge.
+ * @param out_path  The path of the merged image.
+ */
+    void store(uint64_t key, std::filesystem::path const &out_path);
+
+    /**
+ * Gets the counters of the cache directory.
+ *
+ * @return The hits, misses, stores and evictions so far and the size of the cached images.
+ */
+    [[nodiscard]] ResultCacheStats getStats() const;
+};
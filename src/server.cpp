@@ -0,0 +1,282 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include "bounded_queue.h"
+#include "command_line.h"
+#include "server.h"
+
+namespace {
+
+// a message is a count followed by that many length prefixed strings, both as 32-bit integers in host byte order
+bool write_all(int fd, void const *data, std::size_t size) {
+    auto const *bytes = static_cast<char const *>(data);
+    while (size > 0) {
+        auto const count = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) { continue; }
+        if (count <= 0) { return false; }
+        bytes += count;
+        size -= static_cast<std::size_t>(count);
+    }
+    return true;
+}
+
+bool read_all(int fd, void *data, std::size_t size) {
+    auto *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        auto const count = recv(fd, bytes, size, 0);
+        if (count < 0 && errno == EINTR) { continue; }
+        if (count <= 0) { return false; }
+        bytes += count;
+        size -= static_cast<std::size_t>(count);
+    }
+    return true;
+}
+
+bool send_strings(int fd, std::vector<std::string> const &strings) {
+    auto const count = static_cast<uint32_t>(strings.size());
+    if (!write_all(fd, &count, sizeof(count))) { return false; }
+    for (auto const &string: strings) {
+        auto const size = static_cast<uint32_t>(string.size());
+        if (!write_all(fd, &size, sizeof(size)) || !write_all(fd, string.data(), string.size())) { return false; }
+    }
+    return true;
+}
+
+std::optional<std::vector<std::string>> receive_strings(int fd) {
+    // generous for a command line, small enough that a bad client can not make the server allocate much
+    constexpr uint32_t limit = 1 << 20;
+    uint32_t count{};
+    if (!read_all(fd, &count, sizeof(count)) || count > limit) { return std::nullopt; }
+    std::vector<std::string> ret(count);
+    for (auto &string: ret) {
+        uint32_t size{};
+        if (!read_all(fd, &size, sizeof(size)) || size > limit) { return std::nullopt; }
+        string.resize(size);
+        if (!read_all(fd, string.data(), size)) { return std::nullopt; }
+    }
+    return ret;
+}
+
+sockaddr_un socket_address(std::filesystem::path const &socket_path) {
+    sockaddr_un ret{};
+    ret.sun_family = AF_UNIX;
+    if (socket_path.native().size() >= sizeof(ret.sun_path)) {
+        throw std::runtime_error("Socket path " + socket_path.string() + " is too long.\n");
+    }
+    std::strcpy(ret.sun_path, socket_path.c_str());
+    return ret;
+}
+
+std::map<std::string, Algorithm> const algorithms{{"base", Algorithm::base},
+                                                  {"cache", Algorithm::cache},
+                                                  {"openmp", Algorithm::openmp},
+                                                  {"optimized", Algorithm::optimized},
+                                                  {"simd", Algorithm::simd}};
+
+}
+
+MergeServer::MergeServer(std::filesystem::path socket_path, MergeOptions merge_options, ServerOptions server_options)
+        : socket_path(std::move(socket_path)), merge_options(merge_options), server_options(server_options),
+          cache(server_options.cache_bytes) {}
+
+int MergeServer::handle(const std::filesystem::path &directory, const std::vector<std::string> &command_line,
+                        std::ostream &out, std::ostream &err) {
+    std::map<std::string, std::string> options{};
+    auto const arguments = split_arguments(command_line, options);
+    auto request_options = merge_options;
+    if (!parse_merge_options(options, request_options, err)) {
+        return 1;
+    }
+    auto const resolve = [&](std::filesystem::path const &path) { return path.is_absolute() ? path : directory / path; };
+    if (!request_options.mask.empty()) { request_options.mask = resolve(request_options.mask); }
+    // the merges print why they failed into the client's error stream instead of the server's
+    request_options.errors = &err;
+    // the standard output of the server is not the client's, so a merge can not be written there
+    auto const standard_output = [&](std::filesystem::path const &path) {
+        if (!Bmp::is_standard_output(path)) { return false; }
+        err << "The server can not write a merge to the standard output, give the client an output file.\n";
+        return true;
+    };
+
+    if (arguments.size() == 2 && arguments[1] == "stats") {
+        auto const stats = cache.getStats();
+        out << "hits " << stats.hits << ", misses " << stats.misses << ", evictions " << stats.evictions << ", "
+            << stats.entries << " images, " << stats.bytes << " bytes cached" << std::endl;
+        return 0;
+    }
+
+    ImageMerger merger{request_options};
+    if (arguments.size() >= 2 && arguments[1] == "many") {
+        if (arguments.size() < 5) {
+            err << "Error: Incorrect number of arguments\n";
+            return 1;
+        }
+        auto const mode = blend_mode_from_name(arguments[2]);
+        if (!mode) {
+            err << "Unknown merging method " << arguments[2] << ".\n";
+            return 1;
+        }
+        std::vector<std::filesystem::path> inputs{};
+        for (auto input = arguments.begin() + 4; input != arguments.end(); ++input) { inputs.push_back(resolve(*input)); }
+        std::vector<float> weights{};
+        if (options.contains("weights") && !parse_weights(options["weights"], weights)) {
+            err << "Invalid value for --weights.\n";
+            return 1;
+        }
+        if (standard_output(arguments[3])) {
+            return 1;
+        }
+        auto const path = merger.merge_images_many(*mode, inputs, resolve(arguments[3]), weights);
+        out << path << std::endl;
+        return path.empty() ? 1 : 0;
+    }
+
+    if (arguments.size() >= 2 && arguments[1] == "sequence") {
+        auto const command = parse_sequence_command(arguments, options, err);
+        if (!command) {
+            return 1;
+        }
+        if (standard_output(command->output)) {
+            return 1;
+        }
+        auto const first_image = cache.get(resolve(command->first));
+        auto const second_image = cache.get(resolve(command->second));
+        for (auto const &path: merger.merge_sequence(*first_image, *second_image, resolve(command->output),
+                                                     command->frames, command->ramp)) {
+            out << path << '\n';
+        }
+        return 0;
+    }
+
+    auto const command = parse_merge_command(arguments, err);
+    if (!command || standard_output(command->output)) {
+        return 1;
+    }
+    auto const start = std::chrono::high_resolution_clock::now();
+    if (command->algorithm == "stream") {
+        auto const path = merger.merge_images_streaming(command->mode, resolve(command->first), resolve(command->second),
+                                                        resolve(command->output), command->weight);
+        if (path.empty()) { return 1; }
+        out << path << std::endl;
+    } else if (command->algorithm == "incremental") {
+        auto const path = merger.merge_images_incremental(command->mode, resolve(command->first),
+                                                          resolve(command->second), resolve(command->output),
+                                                          command->weight);
+        if (path.empty()) { return 1; }
+        out << path << std::endl;
+    } else if (auto const algorithm = algorithms.find(command->algorithm); algorithm != algorithms.end()) {
+        std::filesystem::path path{};
+        if (request_options.region) {
+            // only the rows of the rectangle are read, so the cached whole images are not used
+            path = merger.merge_images_roi(command->mode, resolve(command->first), resolve(command->second),
+                                           resolve(command->output), command->weight, *request_options.region,
+                                           request_options.preview, algorithm->second);
+        } else {
+            auto const first_image = cache.get(resolve(command->first));
+            auto const second_image = cache.get(resolve(command->second));
+            path = merger.merge_to_file(command->mode, *first_image, *second_image, command->weight,
+                                        algorithm->second, resolve(command->output));
+        }
+        if (path.empty()) { return 1; }
+        out << path << std::endl;
+    } else {
+        err << "Entered argument <" << command->algorithm
+            << "> is invalid. Supported algorithm versions are <base>, <openmp>, <cache>, <optimized>, <simd>, <stream> and <incremental>\n";
+        return 1;
+    }
+    auto const elapsed = std::chrono::high_resolution_clock::now() - start;
+    out << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / 1000000.0f << std::endl;
+    return 0;
+}
+
+void MergeServer::serve(int connection) {
+    auto request = receive_strings(connection);
+    if (request && !request->empty()) {
+        std::ostringstream out{};
+        std::ostringstream err{};
+        int status = 1;
+        try {
+            // the first string is the working directory of the client, the rest is its command line
+            std::filesystem::path const directory{request->front()};
+            request->erase(request->begin());
+            status = handle(directory, *request, out, err);
+        } catch (std::exception &e) {
+            err << e.what();
+        }
+        send_strings(connection, {std::to_string(status), out.str(), err.str()});
+    }
+    close(connection);
+}
+
+void MergeServer::run() {
+    auto const address = socket_address(socket_path);
+    int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string{"Socket failed to open: "} + std::strerror(errno) + "\n");
+    }
+    unlink(socket_path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0 ||
+        listen(fd, server_options.backlog) != 0) {
+        auto const error = errno;
+        close(fd);
+        throw std::runtime_error("Socket " + socket_path.string() + " failed to listen: " + std::strerror(error) + "\n");
+    }
+    listener = fd;
+
+    BoundedQueue<int> connections{std::max<std::size_t>(server_options.workers, 1) * 4};
+    std::vector<std::jthread> workers{};
+    for (std::size_t i = 0; i < std::max<std::size_t>(server_options.workers, 1); ++i) {
+        workers.emplace_back([&] {
+            while (auto connection = connections.pop()) { serve(*connection); }
+        });
+    }
+    for (;;) {
+        int const connection = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection >= 0) {
+            connections.push(connection);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            break;
+        }
+    }
+    connections.close();
+    workers.clear();
+    listener = -1;
+    close(fd);
+    unlink(socket_path.c_str());
+}
+
+void MergeServer::stop() {
+    // shutdown is async-signal-safe and makes the blocked accept fail
+    if (int const fd = listener; fd >= 0) { shutdown(fd, SHUT_RDWR); }
+}
+
+int run_client(const std::filesystem::path &socket_path, const std::vector<std::string> &command_line,
+               std::ostream &out, std::ostream &err) {
+    auto const address = socket_address(socket_path);
+    int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0) {
+        if (fd >= 0) { close(fd); }
+        err << "No server is listening on " << socket_path.string() << ".\n";
+        return 1;
+    }
+    std::vector<std::string> request{std::filesystem::current_path().string()};
+    request.insert(request.end(), command_line.begin(), command_line.end());
+    std::optional<std::vector<std::string>> response{};
+    if (send_strings(fd, request)) { response = receive_strings(fd); }
+    close(fd);
+    if (!response || response->size() != 3) {
+        err << "The server closed the connection without an answer.\n";
+        return 1;
+    }
+    out << (*response)[1];
+    err << (*response)[2];
+    return std::stoi((*response)[0]);
+}
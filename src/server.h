@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "image_cache.h"
+#include "image_merger.h"
+
+/**
+ * Settings of a MergeServer.
+ */
+struct ServerOptions {
+    std::size_t workers{4};
+    std::size_t cache_bytes{std::size_t{1} << 30};
+    int backlog{64};
+};
+
+/**
+ * A long-running merge process listening on a Unix domain socket. Every connection carries one command line in the
+ * same form the ImageMerger executable takes, and gets back what the executable would have printed together with its
+ * exit status. Inputs of two-image merges come from a shared ImageCache, so an image used by many requests is read
+ * and decoded once. Requests run on a fixed pool of worker threads.
+ */
+class MergeServer {
+    std::filesystem::path socket_path;
+    MergeOptions merge_options;
+    ServerOptions server_options;
+    ImageCache cache;
+    std::atomic<int> listener{-1};
+
+/**
+ * Runs one command line. Relative paths in it are resolved against the working directory of the client, and an
+ * output path of - is rejected, since the standard output of the server is not the client's. Failed merges print why
+ * into err.
+ */
+    int handle(std::filesystem::path const &directory, std::vector<std::string> const &command_line, std::ostream &out,
+               std::ostream &err);
+
+    void serve(int connection);
+
+public:
+    /**
+ * Constructs a server, nothing is opened before run is called.
+ *
+ * @param socket_path     The path of the socket file. An existing file at this path is replaced.
+ * @param merge_options   The default settings of every merge, options sent with a request override them.
+ * @param server_options  The number of workers and the size of the image cache.
+ */
+    MergeServer(std::filesystem::path socket_path, MergeOptions merge_options, ServerOptions server_options);
+
+    /**
+ * Accepts connections until stop is called. Throws std::runtime_error if the socket can not be created.
+ */
+    void run();
+
+    /**
+ * Makes run return once the requests being served are answered. Safe to call from a signal handler.
+ */
+    void stop();
+};
+
+/**
+ * Sends a command line to a running MergeServer and prints its answer, so a call looks like running the executable.
+ *
+ * @param socket_path   The path of the socket of the server.
+ * @param command_line  The command line, starting with the program name.
+ * @param out           Receives what the command printed to its standard output.
+ * @param err           Receives what the command printed to its standard error.
+ * @return The exit status of the command, or 1 if the server could not be reached.
+ */
+int run_client(std::filesystem::path const &socket_path, std::vector<std::string> const &command_line,
+               std::ostream &out, std::ostream &err);
@@ -0,0 +1,594 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <immintrin.h>
+#include "simd_blend.h"
+
+namespace simd {
+
+namespace {
+
+template<typename Op>
+void run_scalar(Op op, const std::byte *first, const std::byte *second, std::byte *out, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+        out[i] = op(first[i], second[i]);
+    }
+}
+
+void run_weighted_scalar(const std::byte *first, const std::byte *second, const std::byte *weights, std::byte *out,
+                         std::size_t size, uint16_t bias) {
+    for (std::size_t i = 0; i < size; ++i) {
+        out[i] = masked_blend(first[i], second[i], weights[i], bias);
+    }
+}
+
+inline bool aligned(const std::byte *data, std::size_t alignment) {
+    return reinterpret_cast<std::uintptr_t>(data) % alignment == 0;
+}
+
+// Every instruction set gets the same set of vector operations in its own namespace, compiled with the matching
+// target pragma. Operations that need more than 8 bits widen the bytes to 16-bit lanes and narrow the result back
+// with an unsigned saturating pack. Unpacking and packing both work per 128-bit lane, so the byte order is preserved
+// for the wider registers as well. The tail of every buffer is handled by the scalar policy.
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+
+namespace sse2 {
+
+using Vector = __m128i;
+constexpr std::size_t width = 16;
+
+inline Vector load(const std::byte *data) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(data)); }
+
+inline void store(std::byte *data, Vector value) { _mm_storeu_si128(reinterpret_cast<__m128i *>(data), value); }
+
+inline Vector load_aligned(const std::byte *data) { return _mm_load_si128(reinterpret_cast<const __m128i *>(data)); }
+
+inline void store_aligned(std::byte *data, Vector value) { _mm_store_si128(reinterpret_cast<__m128i *>(data), value); }
+
+inline Vector all(uint8_t value) { return _mm_set1_epi8(static_cast<char>(value)); }
+
+inline Vector lo16(Vector value) { return _mm_unpacklo_epi8(value, _mm_setzero_si128()); }
+
+inline Vector hi16(Vector value) { return _mm_unpackhi_epi8(value, _mm_setzero_si128()); }
+
+inline Vector pack16(Vector lo, Vector hi) { return _mm_packus_epi16(lo, hi); }
+
+inline Vector multiply_255(Vector x, Vector y) {
+    Vector const t = _mm_add_epi16(_mm_mullo_epi16(x, y), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+inline Vector multiply_255_u8(Vector a, Vector b) {
+    return pack16(multiply_255(lo16(a), lo16(b)), multiply_255(hi16(a), hi16(b)));
+}
+
+inline Vector select(Vector mask, Vector if_set, Vector if_clear) {
+    return _mm_or_si128(_mm_and_si128(mask, if_set), _mm_andnot_si128(mask, if_clear));
+}
+
+inline Vector below_128(Vector a) { return _mm_cmpeq_epi8(_mm_and_si128(a, all(0x80)), _mm_setzero_si128()); }
+
+inline Vector apply(blend_ops::Max, Vector a, Vector b) { return _mm_max_epu8(a, b); }
+
+inline Vector apply(blend_ops::Min, Vector a, Vector b) { return _mm_min_epu8(a, b); }
+
+inline Vector apply(blend_ops::Add, Vector a, Vector b) { return _mm_adds_epu8(a, b); }
+
+inline Vector apply(blend_ops::Subtract, Vector a, Vector b) { return _mm_subs_epu8(a, b); }
+
+inline Vector apply(blend_ops::Difference, Vector a, Vector b) { return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)); }
+
+inline Vector apply(blend_ops::Multiply, Vector a, Vector b) { return multiply_255_u8(a, b); }
+
+inline Vector apply(blend_ops::Screen, Vector a, Vector b) {
+    Vector const ones = all(0xff);
+    return _mm_xor_si128(multiply_255_u8(_mm_xor_si128(a, ones), _mm_xor_si128(b, ones)), ones);
+}
+
+inline Vector apply(blend_ops::Overlay, Vector a, Vector b) {
+    Vector const ones = all(0xff);
+    Vector const inverse_a = _mm_xor_si128(a, ones);
+    Vector const dark = multiply_255_u8(_mm_add_epi8(a, a), b);
+    Vector const light = _mm_xor_si128(multiply_255_u8(_mm_add_epi8(inverse_a, inverse_a), _mm_xor_si128(b, ones)), ones);
+    return select(below_128(a), dark, light);
+}
+
+inline Vector apply(blend_ops::Average op, Vector a, Vector b) {
+    Vector const first_weight = _mm_set1_epi16(static_cast<short>(op.weight.first));
+    Vector const second_weight = _mm_set1_epi16(static_cast<short>(op.weight.second));
+    Vector const bias = _mm_set1_epi16(static_cast<short>(op.weight.bias));
+    Vector const lo = _mm_add_epi16(_mm_mullo_epi16(lo16(a), first_weight), _mm_mullo_epi16(lo16(b), second_weight));
+    Vector const hi = _mm_add_epi16(_mm_mullo_epi16(hi16(a), first_weight), _mm_mullo_epi16(hi16(b), second_weight));
+    return pack16(_mm_srli_epi16(_mm_add_epi16(lo, bias), 8), _mm_srli_epi16(_mm_add_epi16(hi, bias), 8));
+}
+
+// SSE2 has no gathers, so the table lookups are done one byte at a time
+inline Vector apply(blend_ops::Linear op, Vector a, Vector b) {
+    alignas(width) std::array<std::byte, width> first{};
+    alignas(width) std::array<std::byte, width> second{};
+    store_aligned(first.data(), a);
+    store_aligned(second.data(), b);
+    for (std::size_t i = 0; i < width; ++i) { first[i] = op(first[i], second[i]); }
+    return load_aligned(first.data());
+}
+
+// the weights are stretched from [0,255] to [0,256] like masked_blend does
+inline Vector weighted16(Vector a, Vector b, Vector weight, Vector bias) {
+    Vector const first_weight = _mm_add_epi16(weight, _mm_srli_epi16(weight, 7));
+    Vector const second_weight = _mm_sub_epi16(_mm_set1_epi16(256), first_weight);
+    Vector const sum = _mm_add_epi16(_mm_mullo_epi16(a, first_weight), _mm_mullo_epi16(b, second_weight));
+    return _mm_srli_epi16(_mm_add_epi16(sum, bias), 8);
+}
+
+inline Vector weighted(Vector a, Vector b, Vector weight, Vector bias) {
+    return pack16(weighted16(lo16(a), lo16(b), lo16(weight), bias), weighted16(hi16(a), hi16(b), hi16(weight), bias));
+}
+
+void run_weighted(const std::byte *first, const std::byte *second, const std::byte *weights, std::byte *out,
+                  std::size_t size, uint16_t bias) {
+    Vector const bias16 = _mm_set1_epi16(static_cast<short>(bias));
+    std::size_t i = 0;
+    for (; i + width <= size; i += width) {
+        store(out + i, weighted(load(first + i), load(second + i), load(weights + i), bias16));
+    }
+    run_weighted_scalar(first + i, second + i, weights + i, out + i, size - i, bias);
+}
+
+template<typename Op>
+void run(Op op, const std::byte *first, const std::byte *second, std::byte *out, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + width <= size; i += width) {
+        store(out + i, apply(op, load(first + i), load(second + i)));
+    }
+    run_scalar(op, first + i, second + i, out + i, size - i);
+}
+
+template<typename Op>
+void run_aligned(Op op, const std::byte *first, const std::byte *second, std::byte *out, std::size_t size) {
+    std::size_t const head = std::min(size, (width - reinterpret_cast<std::uintptr_t>(out) % width) % width);
+    run_scalar(op, first, second, out, head);
+    std::size_t i = head;
+    if (aligned(first + i, width) && aligned(second + i, width)) {
+        for (; i + width <= size; i += width) {
+            store_aligned(out + i, apply(op, load_aligned(first + i), load_aligned(second + i)));
+        }
+    } else {
+        for (; i + width <= size; i += width) {
+            store_aligned(out + i, apply(op, load(first + i), load(second + i)));
+        }
+    }
+    run_scalar(op, first + i, second + i, out + i, size - i);
+}
+
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace avx2 {
+
+using Vector = __m256i;
+constexpr std::size_t width = 32;
+
+inline Vector load(const std::byte *data) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data)); }
+
+inline void store(std::byte *data, Vector value) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(data), value); }
+
+inline Vector load_aligned(const std::byte *data) { return _mm256_load_si256(reinterpret_cast<const __m256i *>(data)); }
+
+inline void store_aligned(std::byte *data, Vector value) { _mm256_store_si256(reinterpret_cast<__m256i *>(data), value); }
+
+inline Vector all(uint8_t value) { return _mm256_set1_epi8(static_cast<char>(value)); }
+
+inline Vector lo16(Vector value) { return _mm256_unpacklo_epi8(value, _mm256_setzero_si256()); }
+
+inline Vector hi16(Vector value) { return _mm256_unpackhi_epi8(value, _mm256_setzero_si256()); }
+
+inline Vector pack16(Vector lo, Vector hi) { return _mm256_packus_epi16(lo, hi); }
+
+inline Vector multiply_255(Vector x, Vector y) {
+    Vector const t = _mm256_add_epi16(_mm256_mullo_epi16(x, y), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+inline Vector multiply_255_u8(Vector a, Vector b) {
+    return pack16(multiply_255(lo16(a), lo16(b)), multiply_255(hi16(a), hi16(b)));
+}
+
+inline Vector below_128(Vector a) { return _mm256_cmpeq_epi8(_mm256_and_si256(a, all(0x80)), _mm256_setzero_si256()); }
+
+inline Vector apply(blend_ops::Max, Vector a, Vector b) { return _mm256_max_epu8(a, b); }
+
+inline Vector apply(blend_ops::Min, Vector a, Vector b) { return _mm256_min_epu8(a, b); }
+
+inline Vector apply(blend_ops::Add, Vector a, Vector b) { return _mm256_adds_epu8(a, b); }
+
+inline Vector apply(blend_ops::Subtract, Vector a, Vector b) { return _mm256_subs_epu8(a, b); }
+
+inline Vector apply(blend_ops::Difference, Vector a, Vector b) {
+    return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+inline Vector apply(blend_ops::Multiply, Vector a, Vector b) { return multiply_255_u8(a, b); }
+
+inline Vector apply(blend_ops::Screen, Vector a, Vector b) {
+    Vector const ones = all(0xff);
+    return _mm256_xor_si256(multiply_255_u8(_mm256_xor_si256(a, ones), _mm256_xor_si256(b, ones)), ones);
+}
+
+inline Vector apply(blend_ops::Overlay, Vector a, Vector b) {
+    Vector const ones = all(0xff);
+    Vector const inverse_a = _mm256_xor_si256(a, ones);
+    Vector const dark = multiply_255_u8(_mm256_add_epi8(a, a), b);
+    Vector const light =
+            _mm256_xor_si256(multiply_255_u8(_mm256_add_epi8(inverse_a, inverse_a), _mm256_xor_si256(b, ones)), ones);
+    return _mm256_blendv_epi8(light, dark, below_128(a));
+}
+
+inline Vector apply(blend_ops::Average op, Vector a, Vector b) {
+    Vector const first_weight = _mm256_set1_epi16(static_cast<short>(op.weight.first));
+    Vector const second_weight = _mm256_set1_epi16(static_cast<short>(op.weight.second));
+    Vector const bias = _mm256_set1_epi16(static_cast<short>(op.weight.bias));
+    Vector const lo = _mm256_add_epi16(_mm256_mullo_epi16(lo16(a), first_weight), _mm256_mullo_epi16(lo16(b), second_weight));
+    Vector const hi = _mm256_add_epi16(_mm256_mullo_epi16(hi16(a), first_weight), _mm256_mullo_epi16(hi16(b), second_weight));
+    return pack16(_mm256_srli_epi16(_mm256_add_epi16(lo, bias), 8), _mm256_srli_epi16(_mm256_add_epi16(hi, bias), 8));
+}
+
+// looks up the blends of eight pairs of bytes with one gather of four bytes each, keeping the lowest one
+inline Vector linear8(blend_ops::Linear op, __m128i a, __m128i b) {
+    Vector const index = _mm256_or_si256(_mm256_slli_epi32(_mm256_cvtepu8_epi32(a), 8), _mm256_cvtepu8_epi32(b));
+    Vector const blended = _mm256_i32gather_epi32(reinterpret_cast<const int *>(op.table), index, 1);
+    return _mm256_and_si256(blended, _mm256_set1_epi32(0xff));
+}
+
+inline Vector apply(blend_ops::Linear op, Vector a, Vector b) {
+    __m128i const a_lo = _mm256_castsi256_si128(a);
+    __m128i const a_hi = _mm256_extracti128_si256(a, 1);
+    __m128i const b_lo = _mm256_castsi256_si128(b);
+    __m128i const b_hi = _mm256_extracti128_si256(b, 1);
+    Vector const r0 = linear8(op, a_lo, b_lo);
+    Vector const r1 = linear8(op, _mm_srli_si128(a_lo, 8), _mm_srli_si128(b_lo, 8));
+    Vector const r2 = linear8(op, a_hi, b_hi);
+    Vector const r3 = linear8(op, _mm_srli_si128(a_hi, 8), _mm_srli_si128(b_hi, 8));
+    // packing works per 128-bit lane, the permutation puts the groups of four bytes back in order
+    Vector const packed = _mm256_packus_epi16(_mm256_packus_epi32(r0, r1), _mm256_packus_epi32(r2, r3));
+    return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+// the weights are stretched from [0,255] to [0,256] like masked_blend does
+inline Vector weighted16(Vector a, Vector b, Vector weight, Vector bias) {
+    Vector const first_weight = _mm256_add_epi16(weight, _mm256_srli_epi16(weight, 7));
+    Vector const second_weight = _mm256_sub_epi16(_mm256_set1_epi16(256), first_weight);
+    Vector const sum = _mm256_add_epi16(_mm256_mullo_epi16(a, first_weight), _mm256_mullo_epi16(b, second_weight));
+    return _mm256_srli_epi16(_mm256_add_epi16(sum, bias), 8);
+}
+
+inline Vector weighted(Vector a, Vector b, Vector weight, Vector bias) {
+    return pack16(weighted16(lo16(a), lo16(b), lo16(weight), bias), weighted16(hi16(a), hi16(b), hi16(weight), bias));
+}
+
+void run_weighted(const std::byte *first, const std::byte *second, const std::byte *weights, std::byte *out,
+                  std::size_t size, uint16_t bias) {
+    Vector const bias16 = _mm256_set1_epi16(static_cast<short>(bias));
+    std::size_t i = 0;
+    for (; i + width <= size; i += width) {
+        store(out + i, weighted(load(first + i), load(second + i), load(weights + i), bias16));
+    }
+    run_weighted_scalar(first + i, second + i, weights + i, out + i, size - i, bias);
+}
+
+template<typename Op>
+void run(Op op, const std::byte *first, const std::byte *second, std::byte *out, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + width <= size; i += width) {
+        store(out + i, apply(op, load(first + i), load(second + i)));
+    }
+    run_scalar(op, first + i, second + i, out + i, size - i);
+}
+
+template<typename Op>
+void run_aligned(Op op, const std::byte *first, const std::byte *second, std::byte *out, std::size_t size) {
+    std::size_t const head = std::min(size, (width - reinterpret_cast<std::uintptr_t>(out) % width) % width);
+    run_scalar(op, first, second, out, head);
+    std::size_t i = head;
+    if (aligned(first + i, width) && aligned(second + i, width)) {
+        for (; i + width <= size; i += width) {
+            store_aligned(out + i, apply(op, load_aligned(first + i), load_aligned(second + i)));
+        }
+    } else {
+        for (; i + width <= size; i += width) {
+            store_aligned(out + i, apply(op, load(first + i), load(second + i)));
+        }
+    }
+    run_scalar(op, first + i, second + i, out + i, size - i);
+}
+
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+
+namespace avx512 {
+
+using Vector = __m512i;
+constexpr std::size_t width = 64;
+
+inline Vector load(const std::byte *data) { return _mm512_loadu_si512(data); }
+
+inline void store(std::byte *data, Vector value) { _mm512_storeu_si512(data, value); }
+
+inline Vector load_aligned(const std::byte *data) { return _mm512_load_si512(data); }
+
+inline void store_aligned(std::byte *data, Vector value) { _mm512_store_si512(data, value); }
+
+inline Vector all(uint8_t value) { return _mm512_set1_epi8(static_cast<char>(value)); }
+
+inline Vector lo16(Vector value) { return _mm512_unpacklo_epi8(value, _mm512_setzero_si512()); }
+
+inline Vector hi16(Vector value) { return _mm512_unpackhi_epi8(value, _mm512_setzero_si512()); }
+
+inline Vector pack16(Vector lo, Vector hi) { return _mm512_packus_epi16(lo, hi); }
+
+inline Vector multiply_255(Vector x, Vector y) {
+    Vector const t = _mm512_add_epi16(_mm512_mullo_epi16(x, y), _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+}
+
+inline Vector multiply_255_u8(Vector a, Vector b) {
+    return pack16(multiply_255(lo16(a), lo16(b)), multiply_255(hi16(a), hi16(b)));
+}
+
+inline Vector apply(blend_ops::Max, Vector a, Vector b) { return _mm512_max_epu8(a, b); }
+
+inline Vector apply(blend_ops::Min, Vector a, Vector b) { return _mm512_min_epu8(a, b); }
+
+inline Vector apply(blend_ops::Add, Vector a, Vector b) { return _mm512_adds_epu8(a, b); }
+
+inline Vector apply(blend_ops::Subtract, Vector a, Vector b) { return _mm512_subs_epu8(a, b); }
+
+inline Vector apply(blend_ops::Difference, Vector a, Vector b) {
+    return _mm512_or_si512(_mm512_subs_epu8(a, b), _mm512_subs_epu8(b, a));
+}
+
+inline Vector apply(blend_ops::Multiply, Vector a, Vector b) { return multiply_255_u8(a, b); }
+
+inline Vector apply(blend_ops::Screen, Vector a, Vector b) {
+    Vector const ones = all(0xff);
+    return _mm512_xor_si512(multiply_255_u8(_mm512_xor_si512(a, ones), _mm512_xor_si512(b, ones)), ones);
+}
+
+inline Vector apply(blend_ops::Overlay, Vector a, Vector b) {
+    Vector const ones = all(0xff);
+    Vector const inverse_a = _mm512_xor_si512(a, ones);
+    Vector const dark = multiply_255_u8(_mm512_add_epi8(a, a), b);
+    Vector const light =
+            _mm512_xor_si512(multiply_255_u8(_mm512_add_epi8(inverse_a, inverse_a), _mm512_xor_si512(b, ones)), ones);
+    // a set top bit selects the light (screen) half
+    return _mm512_mask_blend_epi8(_mm512_test_epi8_mask(a, all(0x80)), dark, light);
+}
+
+inline Vector apply(blend_ops::Average op, Vector a, Vector b) {
+    Vector const first_weight = _mm512_set1_epi16(static_cast<short>(op.weight.first));
+    Vector const second_weight = _mm512_set1_epi16(static_cast<short>(op.weight.second));
+    Vector const bias = _mm512_set1_epi16(static_cast<short>(op.weight.bias));
+    Vector const lo = _mm512_add_epi16(_mm512_mullo_epi16(lo16(a), first_weight), _mm512_mullo_epi16(lo16(b), second_weight));
+    Vector const hi = _mm512_add_epi16(_mm512_mullo_epi16(hi16(a), first_weight), _mm512_mullo_epi16(hi16(b), second_weight));
+    return pack16(_mm512_srli_epi16(_mm512_add_epi16(lo, bias), 8), _mm512_srli_epi16(_mm512_add_epi16(hi, bias), 8));
+}
+
+// looks up the blends of sixteen pairs of bytes with one gather, the lowest byte of each lane is the blend
+inline Vector linear16(blend_ops::Linear op, Vector index) {
+    Vector const blended = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xffff, index, op.table, 1);
+    return _mm512_and_si512(blended, _mm512_set1_epi32(0xff));
+}
+
+// the indices are built and the blends narrowed within 128-bit lanes, so the packs put the bytes back in their order
+inline Vector apply(blend_ops::Linear op, Vector a, Vector b) {
+    Vector const zero = _mm512_setzero_si512();
+    Vector const pairs_lo = _mm512_unpacklo_epi8(b, a);
+    Vector const pairs_hi = _mm512_unpackhi_epi8(b, a);
+    Vector const r0 = linear16(op, _mm512_unpacklo_epi16(pairs_lo, zero));
+    Vector const r1 = linear16(op, _mm512_unpackhi_epi16(pairs_lo, zero));
+    Vector const r2 = linear16(op, _mm512_unpacklo_epi16(pairs_hi, zero));
+    Vector const r3 = linear16(op, _mm512_unpackhi_epi16(pairs_hi, zero));
+    return _mm512_packus_epi16(_mm512_packus_epi32(r0, r1), _mm512_packus_epi32(r2, r3));
+}
+
+// the weights are stretched from [0,255] to [0,256] like masked_blend does
+inline Vector weighted16(Vector a, Vector b, Vector weight, Vector bias) {
+    Vector const first_weight = _mm512_add_epi16(weight, _mm512_srli_epi16(weight, 7));
+    Vector const second_weight = _mm512_sub_epi16(_mm512_set1_epi16(256), first_weight);
+    Vector const sum = _mm512_add_epi16(_mm512_mullo_epi16(a, first_weight), _mm512_mullo_epi16(b, second_weight));
+    return _mm512_srli_epi16(_mm512_add_epi16(sum, bias), 8);
+}
+
+inline Vector weighted(Vector a, Vector b, Vector weight, Vector bias) {
+    return pack16(weighted16(lo16(a), lo16(b), lo16(weight), bias), weighted16(hi16(a), hi16(b), hi16(weight), bias));
+}
+
+void run_weighted(const std::byte *first, const std::byte *second, const std::byte *weights, std::byte *out,
+                  std::size_t size, uint16_t bias) {
+    Vector const bias16 = _mm512_set1_epi16(static_cast<short>(bias));
+    std::size_t i = 0;
+    for (; i + width <= size; i += width) {
+        store(out + i, weighted(load(first + i), load(second + i), load(weights + i), bias16));
+    }
+    run_weighted_scalar(first + i, second + i, weights + i, out + i, size - i, bias);
+}
+
+template<typename Op>
+void run(Op op, const std::byte *first, const std::byte *second, std::byte *out, std::size_t size) {
+    std::size_t i = 0;
+    for (; i + width <= size; i += width) {
+        store(out + i, apply(op, load(first + i), load(second + i)));
+    }
+    run_scalar(op, first + i, second + i, out + i, size - i);
+}
+
+template<typename Op>
+void run_aligned(Op op, const std::byte *first, const std::byte *second, std::byte *out, std::size_t size) {
+    std::size_t const head = std::min(size, (width - reinterpret_cast<std::uintptr_t>(out) % width) % width);
+    run_scalar(op, first, second, out, head);
+    std::size_t i = head;
+    if (aligned(first + i, width) && aligned(second + i, width)) {
+        for (; i + width <= size; i += width) {
+            store_aligned(out + i, apply(op, load_aligned(first + i), load_aligned(second + i)));
+        }
+    } else {
+        for (; i + width <= size; i += width) {
+            store_aligned(out + i, apply(op, load(first + i), load(second + i)));
+        }
+    }
+    run_scalar(op, first + i, second + i, out + i, size - i);
+}
+
+}
+
+#pragma GCC pop_options
+
+bool supported(Isa isa) {
+    switch (isa) {
+        case Isa::scalar: return true;
+        case Isa::sse2: return __builtin_cpu_supports("sse2");
+        case Isa::avx2: return __builtin_cpu_supports("avx2");
+        case Isa::avx512bw: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    return false;
+}
+
+std::atomic<Isa> &current_isa() {
+    static std::atomic<Isa> isa{detect_isa()};
+    return isa;
+}
+
+/**
+ * Runs the kernel of an instruction set over one run of bytes. aligned peels bytes off the front until the output is
+ * aligned to a whole vector, and loads the inputs with aligned loads too if they end up aligned as well.
+ */
+template<typename Op>
+void run_isa(Isa isa, bool aligned, Op op, std::span<const std::byte> first, std::span<const std::byte> second,
+             std::span<std::byte> out) {
+    switch (isa) {
+        case Isa::avx512bw:
+            (aligned ? avx512::run_aligned<Op> : avx512::run<Op>)(op, first.data(), second.data(), out.data(),
+                                                                   first.size());
+            break;
+        case Isa::avx2:
+            (aligned ? avx2::run_aligned<Op> : avx2::run<Op>)(op, first.data(), second.data(), out.data(), first.size());
+            break;
+        case Isa::sse2:
+            (aligned ? sse2::run_aligned<Op> : sse2::run<Op>)(op, first.data(), second.data(), out.data(), first.size());
+            break;
+        case Isa::scalar: run_scalar(op, first.data(), second.data(), out.data(), first.size()); break;
+    }
+}
+
+}
+
+Isa detect_isa() {
+    __builtin_cpu_init();
+    for (auto isa : {Isa::avx512bw, Isa::avx2, Isa::sse2}) {
+        if (supported(isa)) { return isa; }
+    }
+    return Isa::scalar;
+}
+
+Isa active_isa() {
+    return current_isa().load(std::memory_order_relaxed);
+}
+
+Isa select_isa(Isa isa) {
+    __builtin_cpu_init();
+    while (!supported(isa)) {
+        isa = static_cast<Isa>(static_cast<int>(isa) - 1);
+    }
+    current_isa().store(isa, std::memory_order_relaxed);
+    return isa;
+}
+
+const char *isa_name(Isa isa) {
+    switch (isa) {
+        case Isa::scalar: return "scalar";
+        case Isa::sse2: return "sse2";
+        case Isa::avx2: return "avx2";
+        case Isa::avx512bw: return "avx512bw";
+    }
+    return "unknown";
+}
+
+void blend(BlendMode mode, FixedWeight weight, std::span<const std::byte> first, std::span<const std::byte> second,
+           std::span<std::byte> out) {
+    auto const isa = active_isa();
+    with_blend_op(mode, weight, [&](auto op) { run_isa(isa, false, op, first, second, out); });
+}
+
+template<PixelFormat Format>
+void blend_masked(FixedWeight weight, ImageView<Format> first, ImageView<Format> second, MaskView const &mask,
+                  ImageView<Format, std::byte> out, std::size_t begin, std::size_t end) {
+    auto const isa = active_isa();
+    // the weights of a row stay in L1 between being spread from the mask and being used
+    std::vector<std::byte> weights(out.getWidth() * ImageView<Format>::pixel_size);
+    for (std::size_t y = begin; y < end; ++y) {
+        mask.weights(y, ImageView<Format>::pixel_size, weights);
+        auto const a = first.row(y);
+        auto const b = second.row(y);
+        auto const c = out.row(y);
+        auto const run = [&](auto kernel) {
+            kernel(a.data(), b.data(), weights.data(), c.data(), c.size(), weight.bias);
+        };
+        switch (isa) {
+            case Isa::avx512bw: run(avx512::run_weighted); break;
+            case Isa::avx2: run(avx2::run_weighted); break;
+            case Isa::sse2: run(sse2::run_weighted); break;
+            case Isa::scalar: run(run_weighted_scalar); break;
+        }
+        auto const padding = out.padding(y);
+        std::fill(padding.begin(), padding.end(), std::byte{0});
+    }
+}
+
+template void blend_masked<PixelFormat::bgr24>(FixedWeight, ImageView<PixelFormat::bgr24>,
+                                               ImageView<PixelFormat::bgr24>, MaskView const &,
+                                               ImageView<PixelFormat::bgr24, std::byte>, std::size_t, std::size_t);
+
+template void blend_masked<PixelFormat::bgra32>(FixedWeight, ImageView<PixelFormat::bgra32>,
+                                                ImageView<PixelFormat::bgra32>, MaskView const &,
+                                                ImageView<PixelFormat::bgra32, std::byte>, std::size_t, std::size_t);
+
+template<PixelFormat Format>
+void blend(BlendMode mode, FixedWeight weight, ImageView<Format> first, ImageView<Format> second,
+           ImageView<Format, std::byte> out, std::size_t begin, std::size_t end) {
+    auto const isa = active_isa();
+    with_blend_op(mode, weight, [&](auto op) {
+        if constexpr (Format == PixelFormat::bgra32) {
+            // rows of 32-bit pixels have no padding, so rows stored in the same order are one run of whole pixels
+            if (first.isTopDown() == out.isTopDown() && second.isTopDown() == out.isTopDown()) {
+                run_isa(isa, true, op, first.rows(begin, end), second.rows(begin, end), out.rows(begin, end));
+                return;
+            }
+        }
+        for (std::size_t y = begin; y < end; ++y) {
+            run_isa(isa, false, op, first.row(y), second.row(y), out.row(y));
+            auto const padding = out.padding(y);
+            std::fill(padding.begin(), padding.end(), std::byte{0});
+        }
+    });
+}
+
+template void blend<PixelFormat::bgr24>(BlendMode, FixedWeight, ImageView<PixelFormat::bgr24>,
+                                        ImageView<PixelFormat::bgr24>, ImageView<PixelFormat::bgr24, std::byte>,
+                                        std::size_t, std::size_t);
+
+template void blend<PixelFormat::bgra32>(BlendMode, FixedWeight, ImageView<PixelFormat::bgra32>,
+                                         ImageView<PixelFormat::bgra32>, ImageView<PixelFormat::bgra32, std::byte>,
+                                         std::size_t, std::size_t);
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "blend.h"
+#include "image_view.h"
+
+namespace simd {
+
+/**
+ * Instruction set extensions a blend kernel can be built for, ordered from the slowest to the fastest.
+ */
+enum class Isa { scalar, sse2, avx2, avx512bw };
+
+/**
+ * Detects the widest instruction set supported by the running CPU using CPUID.
+ *
+ * @return The best instruction set available on this machine.
+ */
+Isa detect_isa();
+
+/**
+ * Gets the instruction set currently used by the blend kernels. It is detected once on first use.
+ *
+ * @return The active instruction set.
+ */
+Isa active_isa();
+
+/**
+ * Overrides the instruction set used by the blend kernels. Requests for an instruction set the CPU does not support
+ * fall back to the best supported one.
+ *
+ * @param isa The instruction set to use.
+ * @return The instruction set that was actually selected.
+ */
+Isa select_isa(Isa isa);
+
+/**
+ * Gets the printable name of an instruction set.
+ *
+ * @param isa The instruction set.
+ * @return The name of the instruction set.
+ */
+const char *isa_name(Isa isa);
+
+/**
+ * Blends two pixel buffers with the vector kernel of a blend mode, producing the same bytes as the scalar policies
+ * in blend_ops. The mode and the instruction set are chosen once per call.
+ *
+ * @param mode    The blend operation.
+ * @param weight  The fixed-point weight of the first image, used by the average mode.
+ * @param first   The pixels of the first image.
+ * @param second  The pixels of the second image, at least as long as first.
+ * @param out     The output buffer, at least as long as first. It may be the same buffer as first or second.
+ */
+void blend(BlendMode mode, FixedWeight weight, std::span<const std::byte> first, std::span<const std::byte> second,
+           std::span<std::byte> out);
+
+/**
+ * Blends a range of rows of two images of the same size and format. The kernel is specialised for the format: rows
+ * of 24-bit pixels are blended one at a time and their padding in the output is zeroed, while 32-bit images, whose
+ * rows are never padded, are blended as one run with aligned vector stores and, when the inputs share the alignment
+ * of the output, aligned loads. Images may store their rows in different orders.
+ *
+ * @param mode    The blend operation.
+ * @param weight  The fixed-point weight of the first image, used by the average mode.
+ * @param first   The first image.
+ * @param second  The second image.
+ * @param out     The output image.
+ * @param begin   The first row to blend, counted from the top.
+ * @param end     One past the last row to blend.
+ */
+template<PixelFormat Format>
+void blend(BlendMode mode, FixedWeight weight, ImageView<Format> first, ImageView<Format> second,
+           ImageView<Format, std::byte> out, std::size_t begin, std::size_t end);
+
+/**
+ * Blends a range of rows of two images of the same size and format with a weight per pixel, read from a mask of the
+ * same size. The weights of a row are spread over the channels and the row is blended in the same pass, producing the
+ * same bytes as masked_blend. The padding of every row in the output is zeroed.
+ *
+ * @param weight  Only the rounding bias is used, the weights come from the mask.
+ * @param first   The first image, weighted by the mask.
+ * @param second  The second image, weighted by the inverse of the mask.
+ * @param mask    The weights of the first image.
+ * @param out     The output image.
+ * @param begin   The first row to blend, counted from the top.
+ * @param end     One past the last row to blend.
+ */
+template<PixelFormat Format>
+void blend_masked(FixedWeight weight, ImageView<Format> first, ImageView<Format> second, MaskView const &mask,
+                  ImageView<Format, std::byte> out, std::size_t begin, std::size_t end);
+
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "hash.h"
+#include "tile_index.h"
+
+namespace {
+
+constexpr std::array<char, 8> magic{'I', 'M', 'T', 'I', 'L', 'E', 'S', '1'};
+
+}
+
+TileGrid::TileGrid(std::size_t tile, std::size_t bytes_per_pixel, std::size_t size, std::size_t height)
+        : tile(std::max<std::size_t>(tile, 1)), bytes_per_pixel(std::max<std::size_t>(bytes_per_pixel, 1)), size(size),
+          height(height), row_size(height ? size / height : 0) {}
+
+std::size_t TileGrid::columns() const {
+    std::size_t const tile_bytes = tile * bytes_per_pixel;
+    return std::max<std::size_t>((row_size + tile_bytes - 1) / tile_bytes, 1);
+}
+
+std::size_t TileGrid::rows() const {
+    return (height + tile - 1) / tile;
+}
+
+std::size_t TileGrid::column_begin(std::size_t column) const {
+    return column * tile * bytes_per_pixel;
+}
+
+std::size_t TileGrid::column_end(std::size_t column) const {
+    return column + 1 == columns() ? row_size : column_begin(column + 1);
+}
+
+std::pair<std::size_t, std::size_t> TileGrid::segment(std::size_t y, std::size_t begin, std::size_t end) const {
+    std::size_t const offset = y * row_size + column_begin(begin);
+    std::size_t const last = y + 1 == height && end == columns() ? size : y * row_size + column_end(end - 1);
+    return {offset, last - offset};
+}
+
+std::vector<uint64_t> tile_checksums(std::span<const std::byte> pixels, const TileGrid &grid, int threads) {
+    std::vector<uint64_t> ret(grid.columns() * grid.rows());
+#pragma omp parallel for num_threads(threads) schedule(static)
+    for (std::size_t index = 0; index < ret.size(); ++index) {
+        std::size_t const column = index % grid.columns();
+        std::size_t const row = index / grid.columns();
+        // every row segment of the tile is chained into the hash through the seed
+        uint64_t hash = index;
+        for (std::size_t y = row * grid.tile; y < std::min((row + 1) * grid.tile, grid.height); ++y) {
+            auto const [offset, size] = grid.segment(y, column, column + 1);
+            hash = xxh64(pixels.subspan(offset, size), hash);
+        }
+        ret[index] = hash;
+    }
+    return ret;
+}
+
+std::optional<TileIndex> TileIndex::read(const std::filesystem::path &path) {
+    std::ifstream in{path, std::ios::binary};
+    std::array<char, 8> file_magic{};
+    TileIndex ret{};
+    in.read(file_magic.data(), file_magic.size());
+    in.read(reinterpret_cast<char *>(&ret.settings), sizeof(ret.settings));
+    in.read(reinterpret_cast<char *>(&ret.out_size), sizeof(ret.out_size));
+    in.read(reinterpret_cast<char *>(&ret.out_modified), sizeof(ret.out_modified));
+    if (!in || file_magic != magic || ret.settings.columns * ret.settings.rows > (uint64_t{1} << 32)) {
+        return std::nullopt;
+    }
+    auto const tiles = static_cast<std::size_t>(ret.settings.columns * ret.settings.rows);
+    ret.first.resize(tiles);
+    ret.second.resize(tiles);
+    in.read(reinterpret_cast<char *>(ret.first.data()), static_cast<std::streamsize>(tiles * sizeof(uint64_t)));
+    in.read(reinterpret_cast<char *>(ret.second.data()), static_cast<std::streamsize>(tiles * sizeof(uint64_t)));
+    if (!in) { return std::nullopt; }
+    return ret;
+}
+
+void TileIndex::write(const std::filesystem::path &path) const {
+    auto temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream out{temporary, std::ios::binary};
+        out.write(magic.data(), magic.size());
+        out.write(reinterpret_cast<const char *>(&settings), sizeof(settings));
+        out.write(reinterpret_cast<const char *>(&out_size), sizeof(out_size));
+        out.write(reinterpret_cast<const char *>(&out_modified), sizeof(out_modified));
+        out.write(reinterpret_cast<const char *>(first.data()), static_cast<std::streamsize>(first.size() * sizeof(uint64_t)));
+        out.write(reinterpret_cast<const char *>(second.data()), static_cast<std::streamsize>(second.size() * sizeof(uint64_t)));
+        if (!out) {
+            throw std::runtime_error("File " + temporary.string() + " failed to write.\n");
+        }
+    }
+    std::filesystem::rename(temporary, path);
+}
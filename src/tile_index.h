@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+/**
+ * Splits the pixel rows of an image into square tiles. Column ranges are in bytes, the padding at the end of every
+ * row and any bytes after the last full row belong to the last column.
+ */
+struct TileGrid {
+    std::size_t tile{64};
+    std::size_t bytes_per_pixel{3};
+    std::size_t size{};
+    std::size_t height{};
+    std::size_t row_size{};
+
+    TileGrid(std::size_t tile, std::size_t bytes_per_pixel, std::size_t size, std::size_t height);
+
+    [[nodiscard]] std::size_t columns() const;
+
+    [[nodiscard]] std::size_t rows() const;
+
+    [[nodiscard]] std::size_t column_begin(std::size_t column) const;
+
+    [[nodiscard]] std::size_t column_end(std::size_t column) const;
+
+    /**
+ * Gets the bytes of one pixel row that belong to a range of tile columns.
+ *
+ * @param y      The pixel row.
+ * @param begin  The first tile column.
+ * @param end    One past the last tile column.
+ * @return The offset and size of the bytes in the pixel buffer.
+ */
+    [[nodiscard]] std::pair<std::size_t, std::size_t> segment(std::size_t y, std::size_t begin, std::size_t end) const;
+};
+
+/**
+ * Computes a checksum of every tile, in row-major order of the grid.
+ *
+ * @param pixels   The pixels of the image, grid.size bytes.
+ * @param grid     The tiles.
+ * @param threads  The number of OpenMP threads.
+ * @return One xxh64 based checksum per tile.
+ */
+std::vector<uint64_t> tile_checksums(std::span<const std::byte> pixels, TileGrid const &grid, int threads);
+
+/**
+ * The sidecar file of an incrementally merged output. It records the tile checksums of both inputs, what the output
+ * was merged with, and the size and modification time the output had afterwards, so an output that was changed by
+ * anything else is merged from scratch instead of patched.
+ */
+struct TileIndex {
+    // everything but the checksums is compared to decide whether the output can be patched
+    struct Settings {
+        uint64_t tile_size{};
+        uint64_t columns{};
+        uint64_t rows{};
+        uint64_t mode{};
+        uint64_t weight{};
+        uint64_t header_hash{};
+
+        bool operator==(Settings const &) const = default;
+    };
+
+    Settings settings{};
+    uint64_t out_size{};
+    int64_t out_modified{};
+    std::vector<uint64_t> first{};
+    std::vector<uint64_t> second{};
+
+    /**
+ * Reads a sidecar file.
+ *
+ * @param path The path of the sidecar.
+ * @return The index, or an empty optional if the file is missing or malformed.
+ */
+    static std::optional<TileIndex> read(std::filesystem::path const &path);
+
+    /**
+ * Writes the sidecar file, replacing the old one atomically. Throws std::runtime_error if it can not be written.
+ *
+ * @param path The path of the sidecar.
+ */
+    void write(std::filesystem::path const &path) const;
+};
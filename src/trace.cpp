@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <linux/perf_event.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#include "trace.h"
+
+namespace trace {
+
+namespace {
+
+std::atomic<bool> tracing{false};
+std::atomic<bool> with_counters{false};
+std::mutex events_mutex{};
+std::vector<Event> events{};
+auto const epoch = std::chrono::steady_clock::now();
+
+constexpr std::array<char const *, counter_count> counter_names{"cycles", "instructions", "llc_misses", "dtlb_misses"};
+
+/**
+ * Writes microseconds with nanosecond resolution for the duration of a scope, restoring the format of the stream.
+ */
+class Micros {
+    std::ostream &out;
+    std::ios::fmtflags const flags;
+    std::streamsize const precision;
+
+public:
+    explicit Micros(std::ostream &out) : out(out), flags(out.flags()), precision(out.precision()) {
+        out << std::fixed << std::setprecision(3);
+    }
+
+    ~Micros() {
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
+
+uint64_t now_ns() {
+    return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+}
+
+/**
+ * The counters of the calling thread, opened the first time one of its scopes reads them.
+ */
+class ThreadCounters {
+    std::array<int, counter_count> fds{-1, -1, -1, -1};
+
+    static int open_counter(uint32_t type, uint64_t config) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        // user space only, which an unprivileged process may count with the default perf_event_paranoid
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+
+public:
+    uint32_t const thread{static_cast<uint32_t>(gettid())};
+
+    ThreadCounters() {
+        if (!with_counters) { return; }
+        constexpr uint64_t read_miss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        fds = {open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES),
+               open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS),
+               open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | read_miss),
+               open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | read_miss)};
+    }
+
+    ~ThreadCounters() {
+        for (int const fd: fds) {
+            if (fd >= 0) { close(fd); }
+        }
+    }
+
+    ThreadCounters(ThreadCounters const &) = delete;
+
+    ThreadCounters &operator=(ThreadCounters const &) = delete;
+
+    std::array<std::optional<uint64_t>, counter_count> read_all() const {
+        std::array<std::optional<uint64_t>, counter_count> ret{};
+        for (std::size_t i = 0; i < counter_count; ++i) {
+            uint64_t value{};
+            if (fds[i] >= 0 && read(fds[i], &value, sizeof(value)) == sizeof(value)) { ret[i] = value; }
+        }
+        return ret;
+    }
+};
+
+ThreadCounters &thread_counters() {
+    thread_local ThreadCounters counters{};
+    return counters;
+}
+
+}
+
+void enable(bool counters) {
+    std::lock_guard lock{events_mutex};
+    events.clear();
+    with_counters = counters;
+    tracing = true;
+}
+
+bool enabled() {
+    return tracing;
+}
+
+Scope::Scope(const char *name) : name(name), active(tracing) {
+    if (!active) { return; }
+    if (with_counters) { start_counters = thread_counters().read_all(); }
+    // read last, so the counters are not part of the time
+    start_ns = now_ns();
+}
+
+Scope::~Scope() {
+    if (!active) { return; }
+    uint64_t const end_ns = now_ns();
+    auto &counters = thread_counters();
+    Event event{name, counters.thread, start_ns, end_ns - start_ns, {}};
+    if (with_counters) {
+        auto const end_counters = counters.read_all();
+        for (std::size_t i = 0; i < counter_count; ++i) {
+            if (start_counters[i] && end_counters[i]) { event.counters[i] = *end_counters[i] - *start_counters[i]; }
+        }
+    }
+    std::lock_guard lock{events_mutex};
+    events.push_back(event);
+}
+
+void write_json(std::ostream &out) {
+    struct Phase {
+        std::size_t count{};
+        uint64_t total_ns{};
+        std::array<std::optional<uint64_t>, counter_count> counters{};
+    };
+    std::lock_guard lock{events_mutex};
+    Micros const micros{out};
+    std::map<std::string, Phase> phases{};
+    for (auto const &event: events) {
+        auto &phase = phases[event.name];
+        ++phase.count;
+        phase.total_ns += event.duration_ns;
+        for (std::size_t i = 0; i < counter_count; ++i) {
+            if (event.counters[i]) { phase.counters[i] = phase.counters[i].value_or(0) + *event.counters[i]; }
+        }
+    }
+
+    auto const write_counters = [&](auto const &counters) {
+        for (std::size_t i = 0; i < counter_count; ++i) {
+            out << ", \"" << counter_names[i] << "\": ";
+            if (counters[i]) { out << *counters[i]; } else { out << "null"; }
+        }
+    };
+    out << "{\n  \"phases\": {";
+    bool first = true;
+    for (auto const &[name, phase]: phases) {
+        out << (first ? "\n" : ",\n") << "    \"" << name << "\": {\"count\": " << phase.count << ", \"total_us\": "
+            << phase.total_ns / 1000.0;
+        write_counters(phase.counters);
+        out << "}";
+        first = false;
+    }
+    out << "\n  },\n  \"events\": [";
+    first = true;
+    for (auto const &event: events) {
+        out << (first ? "\n" : ",\n") << "    {\"name\": \"" << event.name << "\", \"thread\": " << event.thread
+            << ", \"start_us\": " << event.start_ns / 1000.0 << ", \"duration_us\": " << event.duration_ns / 1000.0;
+        write_counters(event.counters);
+        out << "}";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+}
+
+void write_chrome(std::ostream &out) {
+    std::lock_guard lock{events_mutex};
+    Micros const micros{out};
+    auto const pid = getpid();
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    bool first = true;
+    for (auto const &event: events) {
+        out << (first ? "\n" : ",\n") << "  {\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": " << pid
+            << ", \"tid\": " << event.thread << ", \"ts\": " << event.start_ns / 1000.0 << ", \"dur\": "
+            << event.duration_ns / 1000.0 << ", \"args\": {";
+        bool first_counter = true;
+        for (std::size_t i = 0; i < counter_count; ++i) {
+            if (!event.counters[i]) { continue; }
+            out << (first_counter ? "" : ", ") << "\"" << counter_names[i] << "\": " << *event.counters[i];
+            first_counter = false;
+        }
+        out << "}}";
+        first = false;
+    }
+    out << "\n]}\n";
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+
+/**
+ * A tracer of the phases of a merge. Every traced scope records its thread, its start and its duration, and, when
+ * hardware counters were requested and perf_event_open is permitted, the cycles, instructions, last level cache misses
+ * and data TLB misses of its thread while it ran. Events are kept in memory until they are written as a JSON summary
+ * or as a Chrome trace that chrome://tracing and Perfetto open.
+ *
+ * Tracing is off until enable is called. Built with IMAGE_MERGER_TRACE off, TRACE_SCOPE expands to nothing, so the
+ * traced code carries no cost at all.
+ */
+namespace trace {
+
+/**
+ * The hardware counters a scope can collect, in the order of Event::counters.
+ */
+enum class Counter { cycles, instructions, llc_misses, dtlb_misses };
+
+constexpr std::size_t counter_count = 4;
+
+/**
+ * One finished scope.
+ */
+struct Event {
+    char const *name;
+    uint32_t thread;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    // empty for counters the thread could not open
+    std::array<std::optional<uint64_t>, counter_count> counters;
+};
+
+/**
+ * Starts collecting events, clearing the events collected so far.
+ *
+ * @param counters Whether every scope also reads the hardware counters of its thread.
+ */
+void enable(bool counters);
+
+/**
+ * Gets whether events are collected.
+ *
+ * @return Whether enable was called.
+ */
+bool enabled();
+
+/**
+ * Gets whether the tracer was compiled in.
+ *
+ * @return Whether IMAGE_MERGER_TRACE was on.
+ */
+constexpr bool available() {
+#if IMAGE_MERGER_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Writes the events and, per phase name, their count, total time and counter sums as JSON.
+ *
+ * @param out The stream to write to.
+ */
+void write_json(std::ostream &out);
+
+/**
+ * Writes the events in the Chrome trace event format, with the counters as arguments of every event.
+ *
+ * @param out The stream to write to.
+ */
+void write_chrome(std::ostream &out);
+
+/**
+ * Records the time and counters between its construction and its destruction as one event, if tracing is enabled.
+ */
+class Scope {
+    char const *name;
+    uint64_t start_ns{};
+    std::array<std::optional<uint64_t>, counter_count> start_counters{};
+    bool active;
+
+public:
+    /**
+ * Starts a scope.
+ *
+ * @param name The name of the phase, a string literal that outlives the tracer.
+ */
+    explicit Scope(char const *name);
+
+    ~Scope();
+
+    Scope(Scope const &) = delete;
+
+    Scope &operator=(Scope const &) = delete;
+};
+
+}
+
+#if IMAGE_MERGER_TRACE
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) ::trace::Scope TRACE_CONCAT(trace_scope_, __LINE__){name}
+#else
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#endif